@@ -0,0 +1,153 @@
+#include "buffer_pool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace uppr::gif {
+
+// === Buffer methods ===
+
+Buffer::Buffer(Buffer &&o) noexcept
+    : data{o.data}, size{o.size}, capacity{o.capacity}, pool{o.pool} {
+    o.data = nullptr;
+    o.size = o.capacity = 0;
+}
+
+auto Buffer::operator=(Buffer &&o) noexcept -> Buffer & {
+    if (this == &o) return *this;
+
+    release();
+    data = o.data;
+    size = o.size;
+    capacity = o.capacity;
+    pool = o.pool;
+
+    o.data = nullptr;
+    o.size = o.capacity = 0;
+
+    return *this;
+}
+
+void Buffer::resize(usize new_size) {
+    if (new_size <= capacity) {
+        size = new_size;
+        return;
+    }
+
+    auto &p = pool ? *pool : frame_pool();
+    *this = p.acquire(new_size);
+}
+
+void Buffer::release() {
+    if (data) pool->release(data, capacity);
+
+    data = nullptr;
+    size = capacity = 0;
+}
+
+// === BufferPool methods ===
+
+/// Rounds `size` up to a multiple of `to`, which is a power of 2.
+constexpr auto round_up(usize size, usize to) -> usize {
+    return (size + to - 1) & ~(to - 1);
+}
+
+BufferPool::~BufferPool() {
+    for (auto const &[data, capacity] : free) {
+        std::free(data);
+    }
+}
+
+auto BufferPool::acquire(usize size) -> Buffer {
+    Buffer b;
+    b.pool = this;
+    if (size == 0) return b;
+
+    b.size = size;
+
+    // blocks of a huge page or more start at a huge page boundary, so that
+    // all of them can be backed by huge pages
+    auto const huge = size >= huge_page_size;
+    auto const align = huge ? huge_page_size : alignment;
+    auto const capacity = round_up(size, align);
+
+    {
+        std::lock_guard lock{mutex};
+
+        // the smallest free block that fits, as long as it doesn't waste more
+        // than the block that would be allocated for the buffer (so that
+        // buffers smaller than the alignment can reuse blocks too)
+        auto best = free.end();
+        for (auto it = free.begin(); it != free.end(); ++it) {
+            if (it->second >= size && it->second / 2 <= capacity &&
+                (best == free.end() || it->second < best->second))
+                best = it;
+        }
+
+        if (best != free.end()) {
+            b.data = best->first;
+            b.capacity = best->second;
+            free.erase(best);
+
+            ++stats.reuses;
+            stats.live_bytes += b.capacity;
+            stats.peak_live_bytes =
+                std::max(stats.peak_live_bytes, stats.live_bytes);
+            return b;
+        }
+    }
+
+    b.capacity = capacity;
+    b.data = static_cast<u8 *>(std::aligned_alloc(align, b.capacity));
+    if (!b.data) throw std::bad_alloc{};
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // only a hint, it fails harmlessly when THP are disabled
+    if (huge) madvise(b.data, b.capacity, MADV_HUGEPAGE);
+#endif
+
+    std::lock_guard lock{mutex};
+    ++stats.allocations;
+    if (huge) stats.huge_page_bytes += b.capacity;
+    stats.live_bytes += b.capacity;
+    stats.reserved_bytes += b.capacity;
+    stats.peak_live_bytes = std::max(stats.peak_live_bytes, stats.live_bytes);
+    stats.peak_reserved_bytes =
+        std::max(stats.peak_reserved_bytes, stats.reserved_bytes);
+
+    return b;
+}
+
+void BufferPool::release(u8 *data, usize capacity) {
+    std::lock_guard lock{mutex};
+    free.emplace_back(data, capacity);
+    stats.live_bytes -= capacity;
+}
+
+void BufferPool::track_external(usize allocated, usize freed) {
+    std::lock_guard lock{mutex};
+    stats.external_bytes += allocated;
+    stats.external_bytes -= freed;
+    stats.live_bytes += allocated;
+    stats.live_bytes -= freed;
+    stats.peak_external_bytes =
+        std::max(stats.peak_external_bytes, stats.external_bytes);
+    stats.peak_live_bytes = std::max(stats.peak_live_bytes, stats.live_bytes);
+}
+
+auto BufferPool::snapshot() -> Stats {
+    std::lock_guard lock{mutex};
+    return stats;
+}
+
+auto frame_pool() -> BufferPool & {
+    static BufferPool pool;
+    return pool;
+}
+
+} // namespace uppr::gif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace uppr::gif {
+
+struct BufferPool;
+
+/// A block of memory taken from a `BufferPool`. It goes back to the pool when
+/// destroyed, so that the next buffer of the same size doesn't need to be
+/// allocated again.
+///
+/// The memory is aligned to `BufferPool::alignment` bytes and is not cleared.
+struct Buffer {
+    u8 *data = nullptr;
+    usize size = 0;
+    usize capacity = 0;
+    BufferPool *pool = nullptr;
+
+    Buffer() = default;
+    Buffer(Buffer const &) = delete;
+    Buffer(Buffer &&o) noexcept;
+    auto operator=(Buffer const &) -> Buffer & = delete;
+    auto operator=(Buffer &&o) noexcept -> Buffer &;
+    ~Buffer() { release(); }
+
+    auto get() const -> u8 * { return data; }
+    explicit operator bool() const { return data != nullptr; }
+    auto view() const -> std::span<u8 const> { return {data, size}; }
+
+    /// The memory as an array of `T`, for buffers that don't hold bytes.
+    template <typename T>
+    auto as() const -> T * {
+        return reinterpret_cast<T *>(data);
+    }
+
+    /// Changes the size of the buffer, taking a larger block from the pool if
+    /// needed. The contents are not kept when that happens.
+    void resize(usize new_size);
+
+    /// Gives the memory back to the pool.
+    void release();
+};
+
+/// Keeps blocks of memory that are not in use anymore, to hand them out again.
+///
+/// Blocks are aligned to a cache line. Large ones (whole frames, mostly) are
+/// aligned to and rounded up to huge pages, and the kernel is asked to back them
+/// with transparent huge pages, to avoid TLB misses when walking 4K frames.
+///
+/// Safe to use from multiple threads.
+struct BufferPool {
+    static constexpr usize alignment = 64;
+    static constexpr usize huge_page_size = usize{2} << 20;
+
+    /// How the pool has been used.
+    struct Stats {
+        /// Bytes of the blocks handed out and not given back.
+        usize live_bytes = 0;
+        usize peak_live_bytes = 0;
+        /// Bytes of all blocks owned by the pool, in use or free.
+        usize reserved_bytes = 0;
+        usize peak_reserved_bytes = 0;
+        /// Bytes of the blocks that were meant for huge pages.
+        usize huge_page_bytes = 0;
+        /// How many blocks had to be allocated, and how many were reused.
+        usize allocations = 0;
+        usize reuses = 0;
+        /// Bytes allocated elsewhere (by stb_image) but counted here, they are
+        /// part of `live_bytes` too.
+        usize external_bytes = 0;
+        usize peak_external_bytes = 0;
+    };
+
+    std::mutex mutex;
+    /// Blocks not in use, with their capacity.
+    std::vector<std::pair<u8 *, usize>> free;
+    Stats stats;
+
+    BufferPool() = default;
+    BufferPool(BufferPool const &) = delete;
+    auto operator=(BufferPool const &) -> BufferPool & = delete;
+    ~BufferPool();
+
+    /// Takes a buffer of at least `size` bytes, reusing a free block if there
+    /// is one large enough (but not much larger). A `size` of 0 gives an empty
+    /// buffer of this pool, to be resized later.
+    auto acquire(usize size) -> Buffer;
+
+    /// Takes back a block handed out by `acquire`.
+    void release(u8 *data, usize capacity);
+
+    /// Counts memory that is not handed out by the pool, so that it shows up
+    /// in the stats.
+    void track_external(usize allocated, usize freed);
+
+    /// A copy of the stats, taken while no other thread changes them.
+    auto snapshot() -> Stats;
+};
+
+/// The pool used for frame sized buffers.
+auto frame_pool() -> BufferPool &;
+
+} // namespace uppr::gif
@@ -0,0 +1,351 @@
+#include "decode.hpp"
+
+#include "stb_image.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+// === stb_image allocations ===
+
+// stb_image frees without telling the size, so it is stored right before the
+// memory it gets, keeping malloc's alignment
+static constexpr uppr::gif::usize stbi_header = alignof(std::max_align_t);
+
+extern "C" auto giffer_stbi_malloc(size_t size) -> void * {
+    auto const block = static_cast<uppr::gif::u8 *>(malloc(size + stbi_header));
+    if (!block) return nullptr;
+
+    memcpy(block, &size, sizeof(size));
+    uppr::gif::frame_pool().track_external(size, 0);
+    return block + stbi_header;
+}
+
+extern "C" void giffer_stbi_free(void *p) {
+    if (!p) return;
+
+    auto const block = static_cast<uppr::gif::u8 *>(p) - stbi_header;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    uppr::gif::frame_pool().track_external(0, size);
+    free(block);
+}
+
+extern "C" auto giffer_stbi_realloc(void *p, size_t size) -> void * {
+    if (!p) return giffer_stbi_malloc(size);
+
+    auto const old_block = static_cast<uppr::gif::u8 *>(p) - stbi_header;
+    size_t old_size;
+    memcpy(&old_size, old_block, sizeof(old_size));
+
+    auto const block =
+        static_cast<uppr::gif::u8 *>(realloc(old_block, size + stbi_header));
+    if (!block) return nullptr;
+
+    memcpy(block, &size, sizeof(size));
+    uppr::gif::frame_pool().track_external(size, old_size);
+    return block + stbi_header;
+}
+
+namespace uppr::gif {
+
+auto read_file(std::string const &filename, Buffer &data) -> bool {
+    auto f = std::unique_ptr<FILE, int (*)(FILE *)>{
+        fopen(filename.c_str(), "rb"), fclose};
+    if (!f) return false;
+
+    if (fseek(f.get(), 0, SEEK_END) != 0) return false;
+    auto const size = ftell(f.get());
+    if (size < 0 || fseek(f.get(), 0, SEEK_SET) != 0) return false;
+
+    data.resize(size);
+    return fread(data.get(), 1, data.size, f.get()) == data.size;
+}
+
+// === QOI ===
+
+auto decode_qoi(std::span<u8 const> data, Buffer &pixels)
+    -> std::optional<DecodedImage> {
+    static constexpr usize header_size = 14;
+    static constexpr u8 end_marker[] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+    if (data.size() < header_size || memcmp(data.data(), "qoif", 4) != 0)
+        return std::nullopt;
+
+    auto const be32 = [&](usize at) -> usize {
+        return static_cast<usize>(data[at]) << 24 | data[at + 1] << 16 |
+               data[at + 2] << 8 | data[at + 3];
+    };
+
+    auto const width = be32(4);
+    auto const height = be32(8);
+    if (width == 0 || height == 0 || width > max_image_side ||
+        height > max_image_side)
+        return std::nullopt;
+
+    // a byte of data gives at most a run of 62 pixels, don't allocate for an
+    // image that the data can't fill
+    auto const num_pixels = width * height;
+    if (num_pixels / 62 > data.size() - header_size) return std::nullopt;
+
+    pixels.resize(num_pixels * 4);
+
+    // the previous pixel and the 64 recently seen ones, which ops refer to
+    array<u8, 4> px{0, 0, 0, 255};
+    array<array<u8, 4>, 64> seen{};
+
+    auto pos = header_size;
+    auto out = pixels.get();
+    auto const out_end = out + num_pixels * 4;
+    while (out < out_end) {
+        if (pos >= data.size()) return std::nullopt;
+
+        auto const op = data[pos++];
+        usize run = 1;
+
+        if (op == 0xfe) { // QOI_OP_RGB
+            if (pos + 3 > data.size()) return std::nullopt;
+            px[0] = data[pos];
+            px[1] = data[pos + 1];
+            px[2] = data[pos + 2];
+            pos += 3;
+        } else if (op == 0xff) { // QOI_OP_RGBA
+            if (pos + 4 > data.size()) return std::nullopt;
+            px[0] = data[pos];
+            px[1] = data[pos + 1];
+            px[2] = data[pos + 2];
+            px[3] = data[pos + 3];
+            pos += 4;
+        } else {
+            switch (op >> 6) {
+            case 0: px = seen[op & 0x3f]; break; // QOI_OP_INDEX
+            case 1:                              // QOI_OP_DIFF
+                px[0] += ((op >> 4) & 0x03) - 2;
+                px[1] += ((op >> 2) & 0x03) - 2;
+                px[2] += (op & 0x03) - 2;
+                break;
+            case 2: { // QOI_OP_LUMA
+                if (pos >= data.size()) return std::nullopt;
+                auto const next = data[pos++];
+                auto const dg = (op & 0x3f) - 32;
+                px[0] += dg - 8 + ((next >> 4) & 0x0f);
+                px[1] += dg;
+                px[2] += dg - 8 + (next & 0x0f);
+                break;
+            }
+            case 3: run = (op & 0x3f) + 1; break; // QOI_OP_RUN
+            }
+        }
+
+        seen[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64] = px;
+
+        run = min(run, static_cast<usize>(out_end - out) / 4);
+        for (usize i{}; i < run; ++i) {
+            memcpy(out, px.data(), 4);
+            out += 4;
+        }
+    }
+
+    // the end marker is not needed to decode, but it is part of the image
+    if (pos + sizeof(end_marker) <= data.size() &&
+        memcmp(data.data() + pos, end_marker, sizeof(end_marker)) == 0)
+        pos += sizeof(end_marker);
+
+    return DecodedImage{width, height, pos};
+}
+
+// === PNM ===
+
+/// Reads the next whitespace separated token of a PNM header, skipping
+/// comments.
+auto pnm_token(std::span<u8 const> data, usize &pos) -> std::string_view {
+    auto const is_space = [](u8 c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+               c == '\f';
+    };
+
+    while (pos < data.size()) {
+        if (data[pos] == '#') {
+            while (pos < data.size() && data[pos] != '\n')
+                ++pos;
+        } else if (is_space(data[pos])) {
+            ++pos;
+        } else {
+            break;
+        }
+    }
+
+    auto const start = pos;
+    while (pos < data.size() && !is_space(data[pos]) && data[pos] != '#')
+        ++pos;
+
+    return {reinterpret_cast<char const *>(data.data()) + start, pos - start};
+}
+
+/// Reads a number from a PNM header.
+auto pnm_number(std::span<u8 const> data, usize &pos) -> std::optional<usize> {
+    auto const token = pnm_token(data, pos);
+    if (token.empty()) return std::nullopt;
+
+    // no field is anywhere near this, and it keeps `value` from wrapping
+    if (token.size() > 9) return std::nullopt;
+
+    usize value{};
+    for (auto const c : token) {
+        if (c < '0' || c > '9') return std::nullopt;
+        value = value * 10 + (c - '0');
+    }
+
+    return value;
+}
+
+/// Converts `num_pixels` PNM samples with `channels` channels each to RGBA.
+void pnm_to_rgba(u8 const *src, usize channels, usize maxval,
+                 usize num_pixels, u8 *out) {
+    // the common cases: 8 bits per sample with a full range
+    if (maxval == 255 && channels == 3) {
+        for (usize i{}; i < num_pixels; ++i) {
+            out[i * 4 + 0] = src[i * 3 + 0];
+            out[i * 4 + 1] = src[i * 3 + 1];
+            out[i * 4 + 2] = src[i * 3 + 2];
+            out[i * 4 + 3] = 255;
+        }
+        return;
+    }
+    if (maxval == 255 && channels == 4) {
+        memcpy(out, src, num_pixels * 4);
+        return;
+    }
+
+    // anything else, samples are scaled to 0-255 and 16 bit samples are
+    // big endian
+    auto const wide = maxval > 255;
+    auto const sample = [&](usize i) -> u8 {
+        auto const value = wide ? static_cast<usize>(src[i * 2]) << 8 |
+                                      src[i * 2 + 1]
+                                : src[i];
+        return static_cast<u8>((min(value, maxval) * 255 + maxval / 2) /
+                               maxval);
+    };
+
+    for (usize i{}; i < num_pixels; ++i) {
+        auto const s = i * channels;
+        auto const pix = out + i * 4;
+        if (channels <= 2) {
+            pix[0] = pix[1] = pix[2] = sample(s);
+            pix[3] = channels == 2 ? sample(s + 1) : 255;
+        } else {
+            pix[0] = sample(s);
+            pix[1] = sample(s + 1);
+            pix[2] = sample(s + 2);
+            pix[3] = channels == 4 ? sample(s + 3) : 255;
+        }
+    }
+}
+
+auto parse_pnm_header(std::span<u8 const> data) -> std::optional<PnmHeader> {
+    if (data.size() < 3 || data[0] != 'P') return std::nullopt;
+
+    usize pos = 2;
+    usize width{};
+    usize height{};
+    usize channels{};
+    usize maxval{};
+
+    if (data[1] == '5' || data[1] == '6') {
+        auto const w = pnm_number(data, pos);
+        auto const h = pnm_number(data, pos);
+        auto const m = pnm_number(data, pos);
+        if (!w || !h || !m) return std::nullopt;
+
+        width = *w;
+        height = *h;
+        maxval = *m;
+        channels = data[1] == '5' ? 1 : 3;
+    } else if (data[1] == '7') {
+        // PAM has named header fields, we don't care about TUPLTYPE as the
+        // depth is enough to know what we have
+        for (;;) {
+            auto const key = pnm_token(data, pos);
+            if (key.empty()) return std::nullopt;
+            if (key == "ENDHDR") break;
+
+            if (key == "TUPLTYPE") {
+                pnm_token(data, pos);
+                continue;
+            }
+
+            auto const value = pnm_number(data, pos);
+            if (!value) return std::nullopt;
+
+            if (key == "WIDTH") width = *value;
+            else if (key == "HEIGHT") height = *value;
+            else if (key == "DEPTH") channels = *value;
+            else if (key == "MAXVAL") maxval = *value;
+        }
+    } else {
+        return std::nullopt;
+    }
+
+    if (width == 0 || height == 0 || width > max_image_side ||
+        height > max_image_side || channels == 0 || channels > 4 ||
+        maxval == 0 || maxval > 65535)
+        return std::nullopt;
+
+    // exactly one whitespace between the header and the samples
+    ++pos;
+    if (pos > data.size()) return std::nullopt;
+
+    // can't wrap, with both sides within `max_image_side`
+    auto const samples = width * height * channels * (maxval > 255 ? 2 : 1);
+    return PnmHeader{width, height, channels, maxval, pos, samples};
+}
+
+auto decode_pnm(std::span<u8 const> data, Buffer &pixels)
+    -> std::optional<DecodedImage> {
+    auto const header = parse_pnm_header(data);
+    if (!header) return std::nullopt;
+
+    auto const pos = header->header_size;
+    auto const size = header->samples_size;
+    if (data.size() - pos < size) return std::nullopt;
+
+    auto const num_pixels = header->width * header->height;
+    pixels.resize(num_pixels * 4);
+    pnm_to_rgba(data.data() + pos, header->channels, header->maxval,
+                num_pixels, pixels.get());
+
+    return DecodedImage{header->width, header->height, pos + size};
+}
+
+// === any format ===
+
+auto decode_image(std::span<u8 const> data, Buffer &pixels)
+    -> std::optional<DecodedImage> {
+    if (data.size() >= 4 && memcmp(data.data(), "qoif", 4) == 0)
+        return decode_qoi(data, pixels);
+
+    if (data.size() >= 2 && data[0] == 'P' &&
+        (data[1] == '5' || data[1] == '6' || data[1] == '7'))
+        return decode_pnm(data, pixels);
+
+    int w;
+    int h;
+    int n;
+    auto const image = std::unique_ptr<stbi_uc[], void (*)(stbi_uc *)>{
+        stbi_load_from_memory(data.data(), static_cast<int>(data.size()), &w,
+                              &h, &n, 4),
+        [](stbi_uc *a) { stbi_image_free(a); }};
+    if (!image) return std::nullopt;
+
+    auto const width = static_cast<usize>(w);
+    auto const height = static_cast<usize>(h);
+    if (width > max_image_side || height > max_image_side) return std::nullopt;
+
+    pixels.resize(width * height * 4);
+    memcpy(pixels.get(), image.get(), pixels.size);
+
+    return DecodedImage{width, height, data.size()};
+}
+
+} // namespace uppr::gif
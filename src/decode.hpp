@@ -0,0 +1,63 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "gif.hpp"
+
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace uppr::gif {
+
+/// Largest width or height a GIF can have. Larger images (or headers that
+/// claim them) are rejected by the decoders.
+constexpr usize max_image_side = 0xffff;
+
+/// What was found when decoding an image.
+struct DecodedImage {
+    usize width;
+    usize height;
+    /// How many bytes of the input the image took, as some formats can be
+    /// concatenated one after the other.
+    usize size;
+};
+
+/// Reads all of a file into `data`. The memory of `data` is reused if it is
+/// already large enough.
+auto read_file(std::string const &filename, Buffer &data) -> bool;
+
+/// Decodes a QOI image (https://qoiformat.org) into RGBA `pixels`.
+auto decode_qoi(std::span<u8 const> data, Buffer &pixels)
+    -> std::optional<DecodedImage>;
+
+/// The header of a binary PNM image.
+struct PnmHeader {
+    usize width;
+    usize height;
+    usize channels;
+    usize maxval;
+    /// Where the samples start.
+    usize header_size;
+    /// How many bytes of samples follow the header.
+    usize samples_size;
+};
+
+/// Reads the header of a binary PGM (P5), PPM (P6) or PAM (P7) image. Fails if
+/// `data` ends before the header does.
+auto parse_pnm_header(std::span<u8 const> data) -> std::optional<PnmHeader>;
+
+/// Decodes a binary PGM (P5), PPM (P6) or PAM (P7) image into RGBA `pixels`.
+auto decode_pnm(std::span<u8 const> data, Buffer &pixels)
+    -> std::optional<DecodedImage>;
+
+/// Decodes an image into RGBA `pixels`, picking the decoder by the magic bytes
+/// at the start of `data`. QOI and binary PNM are decoded here directly (and
+/// quite a lot faster), everything else goes through stb_image.
+///
+/// The memory of `pixels` is reused if it is already large enough, otherwise a
+/// larger block is taken from its pool.
+auto decode_image(std::span<u8 const> data, Buffer &pixels)
+    -> std::optional<DecodedImage>;
+
+} // namespace uppr::gif
@@ -0,0 +1,314 @@
+#include "frame_source.hpp"
+
+#include "decode.hpp"
+
+#include <cstring>
+
+namespace uppr::gif {
+
+// === IndexedSource methods ===
+
+auto IndexedSource::next() -> std::optional<Frame> {
+    if (cursor >= count()) return std::nullopt;
+
+    auto frame = load(cursor++);
+    if (!frame) failed = true;
+
+    return frame;
+}
+
+// === FileSource methods ===
+
+auto FileSource::load(usize i) -> std::optional<Frame> {
+    auto const &file = files[i];
+    auto data = pool.acquire(0);
+    Frame frame{pool.acquire(0)};
+
+    auto const image = read_file(file, data)
+                           ? decode_image(data.view(), frame.pixels)
+                           : std::nullopt;
+    if (!image) {
+        fprintf(stderr, "Error opening input file: %s\n", file.c_str());
+        return std::nullopt;
+    }
+
+    frame.width = image->width;
+    frame.height = image->height;
+    frame.delay = delay;
+    return frame;
+}
+
+// === StreamSource methods ===
+
+auto StreamSource::next() -> std::optional<Frame> {
+    data.clear();
+
+    auto c = fgetc(f);
+    if (c == EOF) return std::nullopt; // a clean end of the stream
+
+    // PNM headers are text of no fixed size, so they are read a byte at a
+    // time until one whitespace after the last field, where the samples start
+    std::optional<PnmHeader> header;
+    while (data.size() < 4096) {
+        if (c == EOF) {
+            fprintf(stderr, "Unexpected end of the input stream\n");
+            failed = true;
+            return std::nullopt;
+        }
+
+        data.push_back(static_cast<u8>(c));
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            header = parse_pnm_header(data);
+            if (header && header->header_size == data.size()) break;
+            header.reset();
+        }
+
+        c = fgetc(f);
+    }
+
+    if (!header) {
+        fprintf(stderr, "Invalid image header in the input stream\n");
+        failed = true;
+        return std::nullopt;
+    }
+
+    auto image_data = pool.acquire(header->header_size + header->samples_size);
+    memcpy(image_data.get(), data.data(), header->header_size);
+
+    auto const samples = image_data.get() + header->header_size;
+    if (fread(samples, 1, header->samples_size, f) != header->samples_size) {
+        fprintf(stderr, "Unexpected end of the input stream\n");
+        failed = true;
+        return std::nullopt;
+    }
+
+    Frame frame{pool.acquire(0)};
+    auto const image = decode_pnm(image_data.view(), frame.pixels);
+    if (!image) {
+        fprintf(stderr, "Invalid image in the input stream\n");
+        failed = true;
+        return std::nullopt;
+    }
+
+    frame.width = image->width;
+    frame.height = image->height;
+    frame.delay = delay;
+    return frame;
+}
+
+// === ArchiveSource methods ===
+
+auto ArchiveSource::open(std::string const &filename, usize delay,
+                         BufferPool &pool) -> std::unique_ptr<ArchiveSource> {
+    auto archive = std::make_unique<ArchiveSource>();
+    archive->f = {fopen(filename.c_str(), "rb"), fclose};
+    archive->delay = delay;
+    archive->pool = &pool;
+    if (!archive->f) return nullptr;
+
+    // a tar file is a sequence of 512 byte headers, each followed by the
+    // contents of a file padded to 512 bytes. Two empty blocks end it.
+    static constexpr usize block = 512;
+    array<u8, block> header;
+
+    usize offset{};
+    while (fread(header.data(), 1, block, archive->f.get()) == block) {
+        if (header[0] == 0) break;
+
+        auto const field = [&](usize at, usize size) {
+            auto const start = reinterpret_cast<char const *>(&header[at]);
+            return std::string{start, strnlen(start, size)};
+        };
+
+        auto const size = std::strtoull(field(124, 12).c_str(), nullptr, 8);
+        auto const type = header[156];
+
+        // only regular files, skipping directories, links and extended
+        // headers
+        if (type == '0' || type == 0) {
+            auto name = field(0, 100);
+            auto const prefix = field(345, 155);
+            if (field(257, 5) == "ustar" && !prefix.empty())
+                name = prefix + "/" + name;
+
+            archive->members.push_back({name, offset + block, size});
+        }
+
+        offset += block + (size + block - 1) / block * block;
+        if (fseek(archive->f.get(), static_cast<long>(offset), SEEK_SET) != 0)
+            break;
+    }
+
+    return archive;
+}
+
+auto ArchiveSource::load(usize i) -> std::optional<Frame> {
+    auto const &member = members[i];
+    auto const data = pool->acquire(member.size);
+
+    {
+        std::lock_guard lock{mutex};
+        if (fseek(f.get(), static_cast<long>(member.offset), SEEK_SET) != 0 ||
+            fread(data.get(), 1, data.size, f.get()) != data.size) {
+            fprintf(stderr, "Error reading %s from the archive\n",
+                    member.name.c_str());
+            return std::nullopt;
+        }
+    }
+
+    Frame frame{pool->acquire(0)};
+    auto const image = decode_image(data.view(), frame.pixels);
+    if (!image) {
+        fprintf(stderr, "Error decoding %s from the archive\n",
+                member.name.c_str());
+        return std::nullopt;
+    }
+
+    frame.width = image->width;
+    frame.height = image->height;
+    frame.delay = delay;
+    return frame;
+}
+
+// === PlannedSource methods ===
+
+auto PlannedSource::load(usize i) -> std::optional<Frame> {
+    auto const &planned = plan[i];
+    auto frame = inner->load(planned.inputs.front());
+    if (!frame) return std::nullopt;
+
+    frame->delay = planned.delay;
+    if (planned.inputs.size() == 1) return frame;
+
+    auto const size = frame->width * frame->height * 4;
+    auto const pixels = frame->pixels.get();
+
+    // sums of the frames being blended
+    auto const sum_buffer = frame_pool().acquire(size * sizeof(u32));
+    auto const sum = sum_buffer.as<u32>();
+    std::copy(pixels, pixels + size, sum);
+
+    for (usize j{1}; j < planned.inputs.size(); ++j) {
+        auto const other = inner->load(planned.inputs[j]);
+        if (!other) return std::nullopt;
+        if (other->width != frame->width || other->height != frame->height) {
+            fprintf(stderr, "Can't blend frames of different sizes\n");
+            return std::nullopt;
+        }
+
+        for (usize k{}; k < size; ++k) {
+            sum[k] += other->pixels.get()[k];
+        }
+    }
+
+    auto const n = static_cast<u32>(planned.inputs.size());
+    for (usize k{}; k < size; ++k) {
+        pixels[k] = static_cast<u8>((sum[k] + n / 2) / n);
+    }
+
+    return frame;
+}
+
+// === PrefetchSource methods ===
+
+PrefetchSource::PrefetchSource(std::unique_ptr<FrameSource> inner,
+                               usize threads, usize depth)
+    : inner{std::move(inner)}, depth{max(depth, usize{1})} {
+    indexed = dynamic_cast<IndexedSource *>(this->inner.get());
+
+    // frames of a sequential source can only be read one after the other
+    if (!indexed) threads = 1;
+    // and there is no need for more threads than frames that can wait
+    threads = min(max(threads, usize{1}), this->depth);
+
+    for (usize i{}; i < threads; ++i) {
+        workers.emplace_back([this] { work(); });
+    }
+}
+
+PrefetchSource::~PrefetchSource() {
+    {
+        std::lock_guard lock{mutex};
+        stopping = true;
+    }
+    cv.notify_all();
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void PrefetchSource::set_depth(usize new_depth) {
+    {
+        std::lock_guard lock{mutex};
+        depth = max(new_depth, usize{1});
+    }
+    cv.notify_all();
+}
+
+auto PrefetchSource::waiting() -> usize {
+    std::lock_guard lock{mutex};
+    return ready.size();
+}
+
+void PrefetchSource::work() {
+    for (;;) {
+        usize position;
+        {
+            std::unique_lock lock{mutex};
+            cv.wait(lock, [&] {
+                return stopping || (end && loading >= *end) ||
+                       loading < consumed + depth;
+            });
+            if (stopping || (end && loading >= *end)) return;
+
+            position = loading++;
+        }
+
+        std::optional<Frame> frame;
+        auto error = false;
+        if (indexed) {
+            // indexed sources continue from where they have been left
+            auto const i = indexed->cursor + position;
+            if (i < indexed->count()) {
+                frame = indexed->load(i);
+                error = !frame;
+            }
+        } else {
+            frame = inner->next();
+            error = !frame && inner->failed;
+        }
+
+        {
+            std::lock_guard lock{mutex};
+            if (!frame && (!end || position < *end)) {
+                end = position;
+                end_is_error = error;
+            }
+            ready.emplace(position, std::move(frame));
+        }
+        cv.notify_all();
+    }
+}
+
+auto PrefetchSource::next() -> std::optional<Frame> {
+    std::unique_lock lock{mutex};
+    cv.wait(lock, [&] {
+        return ready.contains(consumed) || (end && consumed >= *end);
+    });
+
+    if (end && consumed >= *end) {
+        failed = end_is_error;
+        return std::nullopt;
+    }
+
+    auto frame = std::move(ready.extract(consumed).mapped());
+    ++consumed;
+
+    lock.unlock();
+    cv.notify_all();
+
+    return frame;
+}
+
+} // namespace uppr::gif
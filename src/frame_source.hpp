@@ -0,0 +1,231 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "gif.hpp"
+#include "input.hpp"
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace uppr::gif {
+
+/// A decoded RGBA frame. Its memory is borrowed from a pool, and goes back to
+/// it once the frame is dropped.
+struct Frame {
+    Buffer pixels;
+    usize width = 0;
+    usize height = 0;
+    /// How long the frame is shown, in hundredths of a second.
+    usize delay = 0;
+};
+
+/// Where the frames of a GIF come from.
+struct FrameSource {
+    /// Set when `next` stopped because of an error (which has already been
+    /// printed to stderr) instead of running out of frames.
+    bool failed = false;
+
+    FrameSource() = default;
+    FrameSource(FrameSource const &) = delete;
+    auto operator=(FrameSource const &) -> FrameSource & = delete;
+    virtual ~FrameSource() = default;
+
+    /// Produces the next frame, or nothing once there are no more.
+    virtual auto next() -> std::optional<Frame> = 0;
+
+    /// How many frames there are, if that is known upfront.
+    virtual auto size() const -> std::optional<usize> { return std::nullopt; }
+};
+
+/// A source where each frame can be produced on its own, in any order and from
+/// many threads at the same time.
+struct IndexedSource : FrameSource {
+    /// The frame that `next` will produce.
+    usize cursor = 0;
+
+    /// How many frames there are.
+    virtual auto count() const -> usize = 0;
+
+    /// Produces frame `i`. Safe to call from multiple threads.
+    virtual auto load(usize i) -> std::optional<Frame> = 0;
+
+    auto next() -> std::optional<Frame> override;
+    auto size() const -> std::optional<usize> override { return count(); }
+};
+
+/// Frames read from a list of image files, in any format `decode_image`
+/// understands.
+struct FileSource : IndexedSource {
+    std::vector<std::string> files;
+    usize delay;
+    BufferPool &pool;
+
+    FileSource(std::vector<std::string> files, usize delay,
+               BufferPool &pool = frame_pool())
+        : files{std::move(files)}, delay{delay}, pool{pool} {}
+
+    auto count() const -> usize override { return files.size(); }
+    auto load(usize i) -> std::optional<Frame> override;
+};
+
+/// Binary PNM images concatenated one after the other in a stream, like
+/// `ffmpeg -i video.mp4 -f image2pipe -c:v ppm -` writes.
+struct StreamSource : FrameSource {
+    FILE *f;
+    usize delay;
+    BufferPool &pool;
+    /// The header of the last image read.
+    std::vector<u8> data;
+
+    StreamSource(FILE *f, usize delay, BufferPool &pool = frame_pool())
+        : f{f}, delay{delay}, pool{pool} {}
+
+    auto next() -> std::optional<Frame> override;
+};
+
+/// Frames stored as files in an uncompressed tar archive, in the order they
+/// appear in it.
+struct ArchiveSource : IndexedSource {
+    /// Where a file is inside of the archive.
+    struct Member {
+        std::string name;
+        usize offset;
+        usize size;
+    };
+
+    std::unique_ptr<FILE, int (*)(FILE *)> f = {nullptr, fclose};
+    std::vector<Member> members;
+    usize delay = 0;
+    BufferPool *pool = nullptr;
+    /// Reads from `f` are not done in parallel, only the decoding is.
+    std::mutex mutex;
+
+    /// Reads the list of files of an archive.
+    static auto open(std::string const &filename, usize delay,
+                     BufferPool &pool = frame_pool())
+        -> std::unique_ptr<ArchiveSource>;
+
+    auto count() const -> usize override { return members.size(); }
+    auto load(usize i) -> std::optional<Frame> override;
+};
+
+/// What the frames of a `SyntheticSource` look like. Each one stresses a
+/// different part of the encoder.
+enum SyntheticContent {
+    /// Colors sweeping smoothly across the whole frame (the default shader of
+    /// shadertoy). Every pixel changes in every frame.
+    CONTENT_GRADIENT,
+    /// Random colors, different in every frame. The worst case for palettes
+    /// and compression.
+    CONTENT_NOISE,
+    /// A flat desktop UI that stays the same but for a moving mouse cursor and
+    /// a blinking caret.
+    CONTENT_UI,
+    /// Lines of text scrolling up, in few colors with sharp edges.
+    CONTENT_TEXT,
+    /// A 16 color low resolution scene with a walking sprite, scaled up.
+    CONTENT_PIXEL_ART,
+    /// A still, grainy background with a shaded ball moving over it, like
+    /// video from a camera that doesn't move.
+    CONTENT_VIDEO,
+};
+
+/// Names of the content types, as given on the command line.
+constexpr std::pair<SyntheticContent, std::string_view>
+    synthetic_contents[] = {
+        {CONTENT_GRADIENT, "gradient"},   {CONTENT_NOISE, "noise"},
+        {CONTENT_UI, "ui"},               {CONTENT_TEXT, "text"},
+        {CONTENT_PIXEL_ART, "pixel-art"}, {CONTENT_VIDEO, "video"},
+};
+
+/// Frames made up by the program, for testing and benchmarking the encoder
+/// without decoding or reading files. Frames are drawn in `load`, so a
+/// `PrefetchSource` draws many of them in parallel.
+struct SyntheticSource : IndexedSource {
+    usize width;
+    usize height;
+    usize frames;
+    usize delay;
+    SyntheticContent content;
+    BufferPool &pool;
+
+    SyntheticSource(usize width, usize height, usize frames, usize delay,
+                    SyntheticContent content = CONTENT_GRADIENT,
+                    BufferPool &pool = frame_pool())
+        : width{width}, height{height}, frames{frames}, delay{delay},
+          content{content}, pool{pool} {}
+
+    auto count() const -> usize override { return frames; }
+    auto load(usize i) -> std::optional<Frame> override;
+};
+
+/// Picks (and maybe blends) the frames of another source following a plan made
+/// by `plan_frames`. Frames of the other source that are not part of the plan
+/// are never loaded.
+struct PlannedSource : IndexedSource {
+    std::unique_ptr<IndexedSource> inner;
+    std::vector<PlannedFrame> plan;
+
+    PlannedSource(std::unique_ptr<IndexedSource> inner,
+                  std::vector<PlannedFrame> plan)
+        : inner{std::move(inner)}, plan{std::move(plan)} {}
+
+    auto count() const -> usize override { return plan.size(); }
+    auto load(usize i) -> std::optional<Frame> override;
+};
+
+/// Produces the frames of another source ahead of time, on background threads,
+/// so that decoding happens while the previous frames are being encoded.
+///
+/// `IndexedSource`s are loaded by `threads` threads at once, other sources by a
+/// single thread. At most `depth` frames are kept waiting to be used.
+struct PrefetchSource : FrameSource {
+    std::unique_ptr<FrameSource> inner;
+    /// `inner`, when it can load frames out of order.
+    IndexedSource *indexed = nullptr;
+    usize depth;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    /// Frames that have been loaded but not used yet, by position.
+    std::map<usize, std::optional<Frame>> ready;
+    /// Position of the next frame to be loaded.
+    usize loading = 0;
+    /// Position of the next frame to be used.
+    usize consumed = 0;
+    /// Position of the first frame that could not be loaded, and why.
+    std::optional<usize> end;
+    bool end_is_error = false;
+    bool stopping = false;
+
+    std::vector<std::thread> workers;
+
+    PrefetchSource(std::unique_ptr<FrameSource> inner, usize threads,
+                   usize depth);
+    ~PrefetchSource() override;
+
+    auto next() -> std::optional<Frame> override;
+    auto size() const -> std::optional<usize> override {
+        return inner->size();
+    }
+
+    /// Changes how many frames can be kept waiting. Frames already loaded are
+    /// kept when lowering it.
+    void set_depth(usize new_depth);
+
+    /// How many frames have been loaded and wait to be used.
+    auto waiting() -> usize;
+
+private:
+    void work();
+};
+
+} // namespace uppr::gif
@@ -1,8 +1,20 @@
 #include "gif.hpp"
+#include "tune.hpp"
 
+#include <atomic>
+#include <bit>
+#include <cstdio>
 #include <cstring>
 #include <optional>
 #include <span>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace uppr::gif {
 
@@ -10,40 +22,138 @@ namespace uppr::gif {
 
 /// Finds all pixels that have changed from the previous image and moves them to
 /// the fromt of th buffer. This allows us to build a palette optimized for the
-/// colors of the changed pixels only.
-auto pick_changed_pixels(u8 const *last_frame, u8 *frame, usize num_pixels)
-    -> int;
+/// colors of the changed pixels only. Transparent pixels are left out, as they
+/// don't need a color. Without `last_frame`, all other pixels are picked.
+auto pick_changed_pixels(u8 const *last_frame, u8 *frame, usize num_pixels,
+                         u8 alpha_threshold) -> int;
+
+/// Finds the smallest rectangle inside of `area` that contains all pixels of
+/// `frame` that differ from `base`. Pixels inside of `cleared` are treated as
+/// if `base` had been cleared to the background there.
+auto find_changed_area(u8 const *base, u8 const *frame, usize width,
+                       Rect const &area, Rect const &cleared = {},
+                       u8 alpha_threshold = 0) -> Rect;
+
+/// Finds the smallest rectangle inside of `area` that contains all pixels that
+/// are transparent in `frame` but painted in `base`. Encoding a frame can't
+/// bring those back to the background, only a disposal can.
+auto find_uncovered_area(u8 const *base, u8 const *frame, usize width,
+                         Rect const &area, u8 alpha_threshold) -> Rect;
+
+/// Checks if an input pixel is meant to be transparent, which is when its
+/// alpha is below `alpha_threshold`. Never, for a threshold of 0.
+constexpr auto transparent(u8 const *pixel, u8 alpha_threshold) -> bool {
+    return pixel[3] < alpha_threshold;
+}
 
-/// Implements Floyd-Steinberg dithering, writes palette value to alpha
-void dither_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
-                  usize width, usize height, Palette &pal);
+/// Checks if `pixel` differs from the one in `base`. Background pixels in
+/// `base` (alpha of 0) always count as changed, as there is nothing to reuse,
+/// unless `pixel` is transparent and so is meant to be background too.
+constexpr auto pixel_changed(u8 const *base, u8 const *pixel,
+                             u8 alpha_threshold = 0) -> bool {
+    if (transparent(pixel, alpha_threshold)) return base[3] != 0;
 
-/// Picks palette colors for the image using simple thresholding, no dithering
-void threshold_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
-                     usize width, usize height, Palette &pal);
+    return base[3] == 0 || base[0] != pixel[0] || base[1] != pixel[1] ||
+           base[2] != pixel[2];
+}
 
 /// Makes a copy of the given image.
-auto copy_image(u8 const *src, usize image_size) -> std::unique_ptr<u8[]> {
-    auto destroyable_image = std::make_unique<u8[]>(image_size);
+auto copy_image(u8 const *src, usize image_size) -> Buffer {
+    auto destroyable_image = frame_pool().acquire(image_size);
     std::ranges::copy(std::span{src, image_size}, destroyable_image.get());
 
     return destroyable_image;
 }
 
+/// Copies the pixels inside of `rect` from `src` to `dst`.
+void copy_rect(u8 *dst, u8 const *src, usize width, Rect const &rect) {
+    for (auto y = rect.top; y < rect.bottom(); ++y) {
+        auto const offset = (y * width + rect.left) * 4;
+        memcpy(dst + offset, src + offset, rect.width * 4);
+    }
+}
+
+/// Clears the pixels inside of `rect` to the background.
+void clear_rect(u8 *image, usize width, Rect const &rect) {
+    for (auto y = rect.top; y < rect.bottom(); ++y) {
+        memset(image + (y * width + rect.left) * 4, 0, rect.width * 4);
+    }
+}
+
+/// Splits the part of `area` that is not inside of `rect` in 4 bands: above,
+/// below, left and right of `rect`. Some of them may be empty.
+auto around(Rect const &rect, Rect const &area) -> array<Rect, 4> {
+    auto const inner = rect.intersect(area);
+    if (inner.empty()) return {area, Rect{}, Rect{}, Rect{}};
+
+    return {
+        Rect{area.left, area.top, area.width, inner.top - area.top},
+        Rect{area.left, inner.bottom(), area.width,
+             area.bottom() - inner.bottom()},
+        Rect{area.left, inner.top, inner.left - area.left, inner.height},
+        Rect{inner.right(), inner.top, area.right() - inner.right(),
+             inner.height},
+    };
+}
+
 // === pallete methods ===
 
+/// Copies the pixels inside of `rect` that a palette is for to `out`, packed
+/// one after the other: those that changed from `last_frame` (all of them
+/// without it) and are not transparent. When `rect` has more than `max_pixels`
+/// pixels, only evenly spaced samples of it are looked at. Gives how many were
+/// copied.
+auto gather_pixels(u8 const *last_frame, u8 const *next_frame, usize width,
+                   Rect const &rect, usize max_pixels, u8 alpha_threshold,
+                   u8 *out) -> usize {
+    auto const sampled = rect.area() > max_pixels;
+
+    usize num_pixels{};
+    if (sampled) {
+        // too large to copy, use every `step`th pixel instead
+        auto const step = (rect.area() + max_pixels - 1) / max_pixels;
+        for (usize i{}; i < rect.area(); i += step) {
+            auto const y = rect.top + i / rect.width;
+            auto const x = rect.left + i % rect.width;
+            auto const offset = (y * width + x) * 4;
+            if (transparent(next_frame + offset, alpha_threshold)) continue;
+            if (last_frame &&
+                !pixel_changed(last_frame + offset, next_frame + offset))
+                continue;
+
+            memcpy(out + num_pixels * 4, next_frame + offset, 4);
+            ++num_pixels;
+        }
+    }
+
+    for (auto y = rect.top; !sampled && y < rect.bottom(); ++y) {
+        auto const offset = (y * width + rect.left) * 4;
+        auto const row = out + num_pixels * 4;
+        memcpy(row, next_frame + offset, rect.width * 4);
+
+        if (last_frame || alpha_threshold != 0)
+            num_pixels += pick_changed_pixels(
+                last_frame ? last_frame + offset : nullptr, row, rect.width,
+                alpha_threshold);
+        else
+            num_pixels += rect.width;
+    }
+
+    return num_pixels;
+}
+
 Palette::Palette(u8 const *last_frame, u8 const *next_frame, usize width,
-                 usize height, int bit_depth, bool build_for_dither)
+                 Rect const &rect, int bit_depth, bool build_for_dither,
+                 usize max_pixels, u8 alpha_threshold)
     : bit_depth{bit_depth} {
     // split_palette is destructive (it sorts the pixels by color) so we must
-    // create a copy of the image for it to destroy
-    auto const image_size = width * height * 4;
-    auto destroyable_image = copy_image(next_frame, image_size);
-
-    auto num_pixels = width * height;
-    if (last_frame)
-        num_pixels = pick_changed_pixels(last_frame, destroyable_image.get(),
-                                         num_pixels);
+    // create a copy of the image for it to destroy. Only the rows inside of
+    // `rect` are needed, packed one after the other.
+    auto destroyable_image =
+        frame_pool().acquire(min(rect.area(), max_pixels) * 4);
+    auto const num_pixels =
+        gather_pixels(last_frame, next_frame, width, rect, max_pixels,
+                      alpha_threshold, destroyable_image.get());
 
     const auto last_elt = 1 << bit_depth;
     const auto split_elt = last_elt / 2;
@@ -57,6 +167,151 @@ Palette::Palette(u8 const *last_frame, u8 const *next_frame, usize width,
     tree_split_elt[1 << (bit_depth - 1)] = 0;
 
     r[0] = g[0] = b[0] = 0;
+    for (usize i{}; i < leaf.size(); ++i) {
+        leaf[i] = static_cast<u8>(i);
+    }
+}
+
+auto Palette::update(u8 const *last_frame, u8 const *next_frame, usize width,
+                     Rect const &rect, int max_error, usize max_pixels,
+                     u8 alpha_threshold) -> std::optional<usize> {
+    max_pixels = min(max_pixels, update_pixels);
+    auto const samples = frame_pool().acquire(min(rect.area(), max_pixels) * 4);
+    auto const image = samples.get();
+    auto const num_pixels = gather_pixels(last_frame, next_frame, width, rect,
+                                          max_pixels, alpha_threshold, image);
+
+    // count the pixels each entry serves well, and move the others to the
+    // front. Once too many are served poorly, the rest don't matter
+    array<usize, 256> served{};
+    usize poor{};
+    for (usize i{}; i < num_pixels; ++i) {
+        if (poor * update_poor_share > num_pixels) return std::nullopt;
+
+        auto best_diff = 1000000;
+        auto best_ind = 1;
+        get_closest_pallete_color(pixat(image, i, RED), pixat(image, i, GREEN),
+                                  pixat(image, i, BLUE), best_ind, best_diff,
+                                  1);
+
+        if (best_diff <= max_error)
+            ++served[best_ind];
+        else
+            swap_pixels(image, i, poor++);
+    }
+    if (poor == 0) return 0;
+
+    array<u8, 256> free{};
+    usize num_free{};
+    for (usize i{1}; i < (usize{1} << bit_depth); ++i) {
+        if (served[i] == 0) free[num_free++] = static_cast<u8>(i);
+    }
+    if (num_free == 0) return std::nullopt;
+
+    // with fewer free entries than poorly served pixels, several of those
+    // share an entry, which can leave some of them as far off as before, and
+    // the rebuilt tree can lead the others to a farther entry than the one
+    // that served them. The updated palette has to serve all of the pixels
+    // well, or it goes back to what it was
+    auto const before = *this;
+    auto const replaced = min(num_free, poor);
+    place_colors(image, poor, free.data(), replaced);
+    sort_entries();
+
+    for (usize i{}; i < num_pixels; ++i) {
+        auto best_diff = 1000000;
+        auto best_ind = 1;
+        get_closest_pallete_color(pixat(image, i, RED), pixat(image, i, GREEN),
+                                  pixat(image, i, BLUE), best_ind, best_diff,
+                                  1);
+        if (best_diff > max_error) {
+            *this = before;
+            return std::nullopt;
+        }
+    }
+
+    return replaced;
+}
+
+void Palette::place_colors(u8 *image, usize num_pixels, u8 const *entries,
+                           usize count) {
+    if (num_pixels == 0 || count == 0) return;
+
+    if (count == 1) {
+        auto const [r, g, b] = find_subcube_average(image, num_pixels);
+        this->r[entries[0]] = static_cast<u8>(r);
+        this->g[entries[0]] = static_cast<u8>(g);
+        this->b[entries[0]] = static_cast<u8>(b);
+        return;
+    }
+
+    auto const half = count / 2;
+    auto const sub_pixels_a = num_pixels * half / count;
+    split_by_largest_range(image, num_pixels, sub_pixels_a);
+
+    place_colors(image, sub_pixels_a, entries, half);
+    place_colors(image + sub_pixels_a * 4, num_pixels - sub_pixels_a,
+                 entries + half, count - half);
+}
+
+void Palette::sort_entries() {
+    // the entries as pixels, with their index in place of the alpha
+    array<u8, 256 * 4> entries{};
+    for (usize i{1}; i < (usize{1} << bit_depth); ++i) {
+        auto const entry = entries.data() + (i - 1) * 4;
+        entry[0] = r[i];
+        entry[1] = g[i];
+        entry[2] = b[i];
+        entry[3] = static_cast<u8>(i);
+    }
+
+    const auto last_elt = 1 << bit_depth;
+    const auto split_elt = last_elt / 2;
+    const auto split_dist = split_elt / 2;
+
+    sort_leaves(entries.data(), 1, last_elt, split_elt, split_dist, 1);
+
+    // the bottom node of the transparency index, like a new palette has
+    tree_split[1 << (bit_depth - 1)] = 0;
+    tree_split_elt[1 << (bit_depth - 1)] = 0;
+    leaf[0] = transparency_index;
+}
+
+void Palette::sort_leaves(u8 *entries, usize first_elt, usize last_elt,
+                          usize split_elt, usize split_dist,
+                          usize tree_node) {
+    if (last_elt == first_elt + 1) {
+        leaf[first_elt] = entries[3];
+        return;
+    }
+
+    auto const sub_entries_a = split_elt - first_elt;
+    auto const split_com =
+        split_by_largest_range(entries, last_elt - first_elt, sub_entries_a);
+
+    tree_split_elt[tree_node] = split_com;
+    tree_split[tree_node] = entries[sub_entries_a * 4 + split_com];
+
+    sort_leaves(entries, first_elt, split_elt, split_elt - split_dist,
+                split_dist / 2, tree_node * 2);
+    sort_leaves(entries + sub_entries_a * 4, split_elt, last_elt,
+                split_elt + split_dist, split_dist / 2, tree_node * 2 + 1);
+}
+
+auto Palette::valid() const -> bool {
+    if (bit_depth < 1 || bit_depth > 8) return false;
+
+    // nodes 1 to `entries - 1` split on R, G or B, and the leaves under them
+    // pick one of the entries
+    auto const entries = usize{1} << bit_depth;
+    for (usize i{1}; i < entries; ++i) {
+        if (tree_split_elt[i] > BLUE) return false;
+    }
+    for (usize i{}; i < entries; ++i) {
+        if (leaf[i] >= entries) return false;
+    }
+
+    return true;
 }
 
 void Palette::write(FILE *f) const {
@@ -73,45 +328,174 @@ void Palette::write(FILE *f) const {
 
 // === implementations ===
 
-auto pick_changed_pixels(u8 const *last_frame, u8 *frame, usize num_pixels)
-    -> int {
+auto pick_changed_pixels(u8 const *last_frame, u8 *frame, usize num_pixels,
+                         u8 alpha_threshold) -> int {
     auto num_changed = 0;
     auto wit = frame;
 
     for (usize i{}; i < num_pixels; ++i) {
-        if (last_frame[0] != frame[0] || last_frame[1] != frame[1] ||
-            last_frame[2] != frame[2]) {
+        if (!transparent(frame, alpha_threshold) &&
+            (!last_frame || pixel_changed(last_frame, frame))) {
             wit[0] = frame[0];
             wit[1] = frame[1];
             wit[2] = frame[2];
             ++num_changed;
             wit += 4;
         }
-        last_frame += 4;
+        if (last_frame) last_frame += 4;
         frame += 4;
     }
 
     return num_changed;
 }
 
+/// Finds the smallest rectangle inside of `area` with all pixels for which
+/// `changed(x, y)` is true.
+template <typename F>
+auto find_area(Rect const &area, F &&changed) -> Rect {
+    auto left = area.right();
+    auto right = area.left;
+    auto top = area.bottom();
+    auto bottom = area.top;
+
+    for (auto y = area.top; y < area.bottom(); ++y) {
+        // find the first changed pixel from the left, if there is none the
+        // whole row is the same
+        auto xl = area.left;
+        while (xl < area.right() && !changed(xl, y))
+            ++xl;
+        if (xl == area.right()) continue;
+
+        // then the last one from the right, which we know exists
+        auto xr = area.right();
+        while (!changed(xr - 1, y))
+            --xr;
+
+        left = min(left, xl);
+        right = max(right, xr);
+        top = min(top, y);
+        bottom = y + 1;
+    }
+
+    if (left >= right) return {};
+    return {left, top, right - left, bottom - top};
+}
+
+auto find_changed_area(u8 const *base, u8 const *frame, usize width,
+                       Rect const &area, Rect const &cleared,
+                       u8 alpha_threshold) -> Rect {
+    return find_area(area, [&](usize x, usize y) {
+        auto const i = (y * width + x) * 4;
+        if (x >= cleared.left && x < cleared.right() && y >= cleared.top &&
+            y < cleared.bottom())
+            return !transparent(frame + i, alpha_threshold);
+
+        return pixel_changed(base + i, frame + i, alpha_threshold);
+    });
+}
+
+auto find_uncovered_area(u8 const *base, u8 const *frame, usize width,
+                         Rect const &area, u8 alpha_threshold) -> Rect {
+    return find_area(area, [&](usize x, usize y) {
+        auto const i = (y * width + x) * 4;
+        return transparent(frame + i, alpha_threshold) && base[i + 3] != 0;
+    });
+}
+
+/// Finds the closest palette colors of pixels, remembering the ones already
+/// found when searching with `Search::cache`.
+struct ColorLookup {
+    /// Slots in the table, picked by a hash of the color. A color takes the
+    /// place of whatever was in its slot.
+    static constexpr usize cache_bits = 14;
+
+    Palette &pal;
+    bool approx;
+    /// `color << 8 | index` for each slot, 0 when empty (index 0 is the
+    /// transparency, which is never picked).
+    Buffer cache;
+
+    ColorLookup(Palette &pal, Search search)
+        : pal{pal}, approx{search == Search::approx},
+          cache{frame_pool().acquire(search == Search::cache
+                                         ? (usize{1} << cache_bits) *
+                                               sizeof(u32)
+                                         : 0)} {
+        if (cache) memset(cache.get(), 0, cache.size);
+    }
+
+    auto find(int r, int g, int b) -> int {
+        // dithering can push colors past 255, those are not worth remembering
+        auto const in_range = static_cast<u32>(r | g | b) <= 255;
+        if (!cache || !in_range) return search(r, g, b);
+
+        auto const color = static_cast<u32>(r << 16 | g << 8 | b);
+        auto const hash = (color * 0x9e3779b1U) >> (32 - cache_bits);
+        auto &slot = cache.as<u32>()[hash];
+        if (slot != 0 && slot >> 8 == color)
+            return static_cast<int>(slot & 0xff);
+
+        auto const ind = search(r, g, b);
+        slot = color << 8 | static_cast<u32>(ind);
+        return ind;
+    }
+
+    auto search(int r, int g, int b) -> int {
+        auto best_diff = 1000000;
+        auto best_ind = 1;
+        if (approx)
+            pal.get_closest_pallete_color<true>(r, g, b, best_ind, best_diff,
+                                                1);
+        else
+            pal.get_closest_pallete_color(r, g, b, best_ind, best_diff, 1);
+        return best_ind;
+    }
+};
+
 void dither_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
-                  usize width, usize height, Palette &pal) {
-    auto const num_pixels = width * height;
+                  u8 *out_indices, usize width, Rect const &rect,
+                  Palette &pal, Search search, u8 alpha_threshold) {
+    ColorLookup lookup{pal, search};
 
-    // quantPixels initially holds color*256 for all pixels
+    auto const row_size = rect.width * 4;
+
+    // quantPixels holds color*256 for the row being mapped and the one below
+    // it, which is all the error diffusion touches.
     // The extra 8 bits of precision allow for sub-single-color error values
     // to be propagated
-    auto quant_pixels = std::make_unique<i32[]>(num_pixels * 4);
+    auto const quant_buffer = frame_pool().acquire(row_size * 2 * sizeof(i32));
+    auto const quant_pixels = quant_buffer.as<i32>();
+
+    auto load_row = [&](usize y) {
+        auto const src = next_frame + ((rect.top + y) * width + rect.left) * 4;
+        auto const dst = quant_pixels + (y % 2) * row_size;
+        for (usize i{}; i < row_size; ++i) {
+            dst[i] = static_cast<int32_t>(src[i]) * 256;
+        }
+    };
 
-    for (usize i{}; i < num_pixels * 4; ++i) {
-        quant_pixels[i] = static_cast<int32_t>(next_frame[i]) * 256;
-    }
+    load_row(0);
+    for (usize y{}; y < rect.height; ++y) {
+        if (y + 1 < rect.height) load_row(y + 1);
 
-    for (usize y{}; y < height; ++y) {
-        for (usize x{}; x < width; ++x) {
-            auto const next_pix = quant_pixels.get() + 4 * (y * width + x);
+        auto const row = quant_pixels + (y % 2) * row_size;
+        auto const row_below = quant_pixels + ((y + 1) % 2) * row_size;
+        for (usize x{}; x < rect.width; ++x) {
+            auto const canvas_idx = (rect.top + y) * width + rect.left + x;
+            auto const next_pix = row + 4 * x;
+            auto const below_pix = row_below + 4 * x;
             auto const last_pix =
-                last_frame ? last_frame + 4 * (y * width + x) : nullptr;
+                last_frame ? last_frame + 4 * canvas_idx : nullptr;
+            auto const out_pix = out_frame + 4 * canvas_idx;
+
+            // transparent pixels show the background, which is what the canvas
+            // has under them. They take no color, so there is no error to
+            // pass on
+            if (transparent(next_frame + 4 * canvas_idx, alpha_threshold)) {
+                memset(out_pix, 0, 4);
+                out_indices[canvas_idx] = transparency_index;
+                continue;
+            }
 
             // Compute the colors we want (rounding to nearest)
             auto const rr = (next_pix[0] + 127) / 256;
@@ -120,20 +504,18 @@ void dither_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
 
             // if it happens that we want the color from last frame, then just
             // write out a transparent pixel
-            if (last_frame && last_pix[0] == rr && last_pix[1] == gg &&
-                last_pix[2] == bb) {
-                next_pix[0] = rr;
-                next_pix[1] = gg;
-                next_pix[2] = bb;
-                next_pix[3] = transparency_index;
+            if (last_frame && last_pix[3] != 0 && last_pix[0] == rr &&
+                last_pix[1] == gg && last_pix[2] == bb) {
+                out_pix[0] = rr;
+                out_pix[1] = gg;
+                out_pix[2] = bb;
+                out_pix[3] = 255;
+                out_indices[canvas_idx] = transparency_index;
                 continue;
             }
 
-            auto best_diff = 1000000;
-            auto best_ind = transparency_index;
-
             // Search the palete
-            pal.get_closest_pallete_color(rr, gg, bb, best_ind, best_diff, 1);
+            auto const best_ind = lookup.find(rr, gg, bb);
 
             // Write the result to the temp buffer
             auto const r_err =
@@ -143,84 +525,128 @@ void dither_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
             auto const b_err =
                 next_pix[2] - static_cast<int32_t>(pal.b[best_ind]) * 256;
 
-            next_pix[0] = pal.r[best_ind];
-            next_pix[1] = pal.g[best_ind];
-            next_pix[2] = pal.b[best_ind];
-            next_pix[3] = best_ind;
+            out_pix[0] = pal.r[best_ind];
+            out_pix[1] = pal.g[best_ind];
+            out_pix[2] = pal.b[best_ind];
+            out_pix[3] = 255;
+            out_indices[canvas_idx] = best_ind;
 
             // Propagate the error to the four adjacent locations
             // that we haven't touched yet
-            auto const quantloc_7 = y * width + x + 1;
-            auto const quantloc_3 = y * width + width + x - 1;
-            auto const quantloc_5 = y * width + width + x;
-            auto const quantloc_1 = y * width + width + x + 1;
+            auto const has_right = x + 1 < rect.width;
+            auto const has_below = y + 1 < rect.height;
 
-            if (quantloc_7 < num_pixels) {
-                auto pix7 = quant_pixels.get() + 4 * quantloc_7;
+            if (has_right) {
+                auto pix7 = next_pix + 4;
                 pix7[0] += max(-pix7[0], r_err * 7 / 16);
                 pix7[1] += max(-pix7[1], g_err * 7 / 16);
                 pix7[2] += max(-pix7[2], b_err * 7 / 16);
             }
 
-            if (quantloc_3 < num_pixels) {
-                auto pix3 = quant_pixels.get() + 4 * quantloc_3;
+            if (has_below && x > 0) {
+                auto pix3 = below_pix - 4;
                 pix3[0] += max(-pix3[0], r_err * 3 / 16);
                 pix3[1] += max(-pix3[1], g_err * 3 / 16);
                 pix3[2] += max(-pix3[2], b_err * 3 / 16);
             }
 
-            if (quantloc_5 < num_pixels) {
-                auto pix5 = quant_pixels.get() + 4 * quantloc_5;
+            if (has_below) {
+                auto pix5 = below_pix;
                 pix5[0] += max(-pix5[0], r_err * 5 / 16);
                 pix5[1] += max(-pix5[1], g_err * 5 / 16);
                 pix5[2] += max(-pix5[2], b_err * 5 / 16);
             }
 
-            if (quantloc_1 < num_pixels) {
-                auto pix1 = quant_pixels.get() + 4 * quantloc_1;
+            if (has_below && has_right) {
+                auto pix1 = below_pix + 4;
                 pix1[0] += max(-pix1[0], r_err / 16);
                 pix1[1] += max(-pix1[1], g_err / 16);
                 pix1[2] += max(-pix1[2], b_err / 16);
             }
         }
     }
+}
 
-    // Copy the palettized result to the output buffer
-    for (usize i{}; i < num_pixels * 4; ++i) {
-        out_frame[i] = quant_pixels[i];
+/// Thresholds the rows of one stripe of `threshold_image`.
+void threshold_rows(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
+                    u8 *out_indices, usize width, Rect const &rect,
+                    ColorLookup &lookup, u8 alpha_threshold) {
+    auto const &pal = lookup.pal;
+    for (auto y = rect.top; y < rect.bottom(); ++y) {
+        auto const row = y * width + rect.left;
+        auto last_pix = last_frame ? last_frame + row * 4 : nullptr;
+        auto next_pix = next_frame + row * 4;
+        auto out_pix = out_frame + row * 4;
+        auto out_idx = out_indices + row;
+
+        for (usize x{}; x < rect.width; ++x) {
+            if (transparent(next_pix, alpha_threshold)) {
+                // shows the background, which the canvas has under it
+                memset(out_pix, 0, 4);
+                *out_idx = transparency_index;
+            } else if (last_pix && !pixel_changed(last_pix, next_pix)) {
+                // if a previous color is available, and it matches the
+                // current color, set the pixel to transparent
+                out_pix[0] = last_pix[0];
+                out_pix[1] = last_pix[1];
+                out_pix[2] = last_pix[2];
+                out_pix[3] = 255;
+                *out_idx = transparency_index;
+            } else {
+                // palettize the pixel
+                auto const best_ind =
+                    lookup.find(next_pix[0], next_pix[1], next_pix[2]);
+
+                // Write the resulting color to the output buffer
+                out_pix[0] = pal.r[best_ind];
+                out_pix[1] = pal.g[best_ind];
+                out_pix[2] = pal.b[best_ind];
+                out_pix[3] = 255;
+                *out_idx = best_ind;
+            }
+
+            if (last_pix) last_pix += 4;
+            next_pix += 4;
+            out_pix += 4;
+            ++out_idx;
+        }
     }
 }
 
 void threshold_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
-                     usize width, usize height, Palette &pal) {
-    auto const num_pixels = width * height;
-    for (usize i{}; i < num_pixels; ++i) {
-        // if a previous color is available, and it matches the current color,
-        // set the pixel to transparent
-        if (last_frame && last_frame[0] == next_frame[0] &&
-            last_frame[1] == next_frame[1] && last_frame[2] == next_frame[2]) {
-            out_frame[0] = last_frame[0];
-            out_frame[1] = last_frame[1];
-            out_frame[2] = last_frame[2];
-            out_frame[3] = transparency_index;
-        } else {
-            // palettize the pixel
-            auto best_diff = 1000000;
-            auto best_ind = 1;
-            pal.get_closest_pallete_color(next_frame[0], next_frame[1],
-                                          next_frame[2], best_ind, best_diff,
-                                          1);
-
-            // Write the resulting color to the output buffer
-            out_frame[0] = pal.r[best_ind];
-            out_frame[1] = pal.g[best_ind];
-            out_frame[2] = pal.b[best_ind];
-            out_frame[3] = best_ind;
+                     u8 *out_indices, usize width, Rect const &rect,
+                     Palette &pal, Search search, usize threads,
+                     usize stripe_rows, u8 alpha_threshold) {
+    stripe_rows = max(stripe_rows, usize{1});
+    auto const stripes = (rect.height + stripe_rows - 1) / stripe_rows;
+    threads = min(threads, stripes);
+
+    // stripes are handed out in order to whichever thread is free, each with
+    // its own lookup table
+    std::atomic<usize> next_stripe{};
+    auto work = [&] {
+        ColorLookup lookup{pal, search};
+        for (;;) {
+            auto const stripe = next_stripe++;
+            if (stripe >= stripes) return;
+
+            auto const top = rect.top + stripe * stripe_rows;
+            threshold_rows(last_frame, next_frame, out_frame, out_indices,
+                           width,
+                           Rect{rect.left, top, rect.width,
+                                min(stripe_rows, rect.bottom() - top)},
+                           lookup, alpha_threshold);
         }
+    };
 
-        if (last_frame) last_frame += 4;
-        out_frame += 4;
-        next_frame += 4;
+    std::vector<std::thread> workers;
+    for (usize i{1}; i < threads; ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+
+    for (auto &worker : workers) {
+        worker.join();
     }
 }
 
@@ -229,6 +655,7 @@ void threshold_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
 void BitStatus::write_chunk(FILE *f) {
     fputc(static_cast<int>(chunk_index), f);
     fwrite(chunk.data(), 1, chunk_index, f);
+    written += chunk_index + 1;
 
     bit_index = 0;
     byte = 0;
@@ -244,6 +671,30 @@ void BitStatus::write_code(FILE *f, u32 code, u32 length) {
     }
 }
 
+// === ActiveArea methods ===
+
+ActiveArea::ActiveArea(u8 const *first_frame, usize width, usize height,
+                       u8 alpha_threshold)
+    : width{width}, height{height}, alpha_threshold{alpha_threshold},
+      first_frame{copy_image(first_frame, width * height * 4)} {
+    // alpha of 0 means background, which would count as changed everywhere,
+    // so only transparent pixels get it
+    for (usize i{}; i < width * height; ++i) {
+        auto const pixel = this->first_frame.get() + i * 4;
+        pixel[ALPHA] = transparent(pixel, alpha_threshold) ? 0 : 255;
+    }
+}
+
+void ActiveArea::add_frame(u8 const *image) {
+    // pixels inside of the area are already known to change, only the bands
+    // around it need to be checked
+    for (auto const &band : around(area, Rect{0, 0, width, height})) {
+        if (band.empty()) continue;
+        area = area.merge(find_changed_area(first_frame.get(), image, width,
+                                            band, {}, alpha_threshold));
+    }
+}
+
 // === compression handling ===
 
 /// The LZW dictionary is a 256-ary tree constructed as the file is encoded,
@@ -252,15 +703,139 @@ struct GifLzwNode {
     array<u16, 256> next;
 };
 
+/// How many nodes the LZW dictionary has, one per possible code.
+static constexpr usize codetree_size = 4096;
+
+/// A code of a compressed image, and how many bits it is written with.
+struct LzwCode {
+    u16 code;
+    u16 size;
+};
+
+/// How many codes `lzw_parse` can give for `size` indices: one per index at
+/// most, a clear code each time the dictionary fills up, and the codes around
+/// them.
+static constexpr auto lzw_max_codes(usize size) -> usize {
+    return size + size / 256 + 4;
+}
+
+/// How much shorter than the longest one a run taken by the flexible parse
+/// can be. Going further back is slow on long runs of flat colors, and
+/// saves no more on the example contents.
+static constexpr usize lzw_lookahead = 4;
+
+/// LZW-compresses `data` into `codes`, from the clear code that starts it to
+/// the end of information code, and gives how many codes that took.
+///
+/// Without `flexible`, each code is the longest run in the dictionary, the
+/// same codes the streaming encoder of `write_lzw_image` writes. With it, a
+/// shorter run (by up to `lzw_lookahead`) is taken whenever that lets the run
+/// after it end further along. The decoder still adds the shorter run and the
+/// index after it to its dictionary, which may already have that entry: the
+/// code is used up all the same, so the encoder does too and stays in step
+/// with it.
+auto lzw_parse(u8 const *data, usize size, int min_code_size,
+               GifLzwNode *codetree, bool flexible, LzwCode *codes) -> usize {
+    auto const clear_code = u32{1} << min_code_size;
+    auto code_size = static_cast<u32>(min_code_size + 1);
+    auto max_code = clear_code + 1;
+
+    usize count{};
+    auto emit = [&](u32 code, u32 bits) {
+        codes[count++] = {static_cast<u16>(code), static_cast<u16>(bits)};
+    };
+
+    // how many indices from `i` on are a run in the dictionary
+    auto run_length = [&](usize i) {
+        u32 code = data[i];
+        usize length = 1;
+        for (; i + length < size; ++length) {
+            auto const next = codetree[code].next[data[i + length]];
+            if (!next) break;
+            code = next;
+        }
+        return length;
+    };
+
+    memset(codetree, 0, sizeof(GifLzwNode) * codetree_size);
+    emit(clear_code, code_size);
+
+    // codes of the runs starting at the current index, by length - 1. A run
+    // can't be longer than there are codes
+    array<u16, codetree_size> path;
+
+    for (usize i{}; i < size;) {
+        usize length = 1;
+        path[0] = data[i];
+        for (; i + length < size; ++length) {
+            auto const next = codetree[path[length - 1]].next[data[i + length]];
+            if (!next) break;
+            path[length] = next;
+        }
+
+        // a shorter run has to get strictly further to be worth its code
+        auto take = length;
+        if (flexible && i + length < size) {
+            auto best = length + run_length(i + length);
+            for (auto l = length - 1; l > 0 && l + lzw_lookahead >= length;
+                 --l) {
+                auto const reach = l + run_length(i + l);
+                if (reach > best) {
+                    best = reach;
+                    take = l;
+                }
+            }
+        }
+
+        emit(path[take - 1], code_size);
+        i += take;
+        if (i == size) break;
+
+        // insert the run and the index after it into the dictionary
+        auto &entry = codetree[path[take - 1]].next[data[i]];
+        ++max_code;
+        if (!entry) entry = static_cast<u16>(max_code);
+
+        if (max_code >= (1UL << code_size)) code_size++;
+        if (max_code == 4095) {
+            emit(clear_code, code_size);
+
+            memset(codetree, 0, sizeof(GifLzwNode) * codetree_size);
+            code_size = min_code_size + 1;
+            max_code = clear_code + 1;
+        }
+    }
+
+    // compression footer
+    emit(clear_code, code_size);
+    emit(clear_code + 1, min_code_size + 1);
+
+    return count;
+}
+
 /// write the image header, LZW-compress and write out the image
-void write_lzw_image(FILE *f, u8 const *image, usize left, usize top,
-                     usize width, usize height, usize delay,
-                     Palette const &pal) {
+///
+/// `indices` holds one palette index per pixel of a canvas that is `stride`
+/// pixels wide, only the part of it inside of `rect` is written. When
+/// `interlace` is set, the rows are written in the 4 pass interlaced order so
+/// that viewers can show a rough version of the image early.
+///
+/// With `COMPRESS_FAST`, the rows are compressed as they are read. With
+/// `COMPRESS_MAX`, they are gathered first, and parsed both greedily and with
+/// `lzw_parse`'s lookahead to write the smaller one.
+///
+/// Gives how many bytes of image data were written, from the code size to the
+/// block terminator.
+auto write_lzw_image(FILE *f, u8 const *indices, usize stride,
+                     Rect const &rect, usize delay, Disposal disposal,
+                     bool interlace, Palette const &pal,
+                     Compression compression) -> usize {
     // graphics control extension
     fputc(0x21, f);
     fputc(0xf9, f);
     fputc(0x04, f);
-    fputc(0x05, f); // leave prev frame in place, this frame has transparency
+    fputc(disposal << 2 | 0x01, f); // disposal method, this frame has
+                                    // transparency
     fputc(static_cast<int>(delay) & 0xff, f);
     fputc(static_cast<int>(delay >> 8) & 0xff, f);
     fputc(transparency_index, f); // transparent color index
@@ -268,6 +843,7 @@ void write_lzw_image(FILE *f, u8 const *image, usize left, usize top,
 
     fputc(0x2c, f); // image descriptor block
 
+    auto const [left, top, width, height] = rect;
     fputc(static_cast<int>(left & 0xff), f); // corner of image in canvas space
     fputc(static_cast<int>((left >> 8) & 0xff), f);
     fputc(static_cast<int>(top & 0xff), f);
@@ -281,8 +857,8 @@ void write_lzw_image(FILE *f, u8 const *image, usize left, usize top,
     // fputc(0, f); // no local color table, no transparency
     // fputc(0x80, f); // no local color table, but transparency
 
-    // local color table present, 2 ^ bitDepth entries
-    fputc(0x80 + pal.bit_depth - 1, f);
+    // local color table present, 2 ^ bitDepth entries, maybe interlaced
+    fputc(0x80 + (interlace ? 0x40 : 0) + pal.bit_depth - 1, f);
     pal.write(f);
 
     const auto min_code_size = pal.bit_depth;
@@ -290,67 +866,133 @@ void write_lzw_image(FILE *f, u8 const *image, usize left, usize top,
 
     fputc(min_code_size, f); // min code size 8 bits
 
-    static constexpr auto codetree_size = 4096;
-    auto codetree = std::make_unique<GifLzwNode[]>(codetree_size);
-
-    memset(codetree.get(), 0, sizeof(GifLzwNode) * codetree_size);
-    auto curr_code = -1;
-    auto code_size = static_cast<u32>(min_code_size + 1);
-    auto max_code = clear_code + 1;
+    auto const codetree_buffer =
+        frame_pool().acquire(sizeof(GifLzwNode) * codetree_size);
+    auto const codetree = codetree_buffer.as<GifLzwNode>();
 
     BitStatus stat;
 
-    // start with a fresh LZW dictionary
-    stat.write_code(f, clear_code, code_size);
+    // feed the rows in the order the viewer expects them, which for
+    // interlaced images is every 8th row, then the 4th rows in between those,
+    // then the 2nd ones, and at last all odd rows
+    struct Pass {
+        usize first;
+        usize step;
+    };
+    static constexpr Pass interlaced_passes[] = {
+        {0, 8},
+        {4, 8},
+        {2, 4},
+        {1, 2},
+    };
+    static constexpr Pass sequential_passes[] = {{0, 1}};
+
+    auto const passes = interlace ? std::span<Pass const>{interlaced_passes}
+                                  : std::span<Pass const>{sequential_passes};
 
-    for (usize y{}; y < height; ++y) {
-        for (usize x{}; x < width; ++x) {
+    auto for_each_row = [&](auto &&visit) {
+        for (auto const [first, step] : passes) {
+            for (auto y = first; y < height; y += step) {
 #ifdef GIF_FLIP_VERT
-            // bottom-left origin image (such as an OpenGL capture)
-            auto const next_value =
-                image[((height - 1 - yy) * width + xx) * 4 + 3];
+                // bottom-left origin image (such as an OpenGL capture)
+                visit(indices + (top + height - 1 - y) * stride + left);
 #else
-            // top-left origin
-            auto const next_value = image[(y * width + x) * 4 + 3];
+                // top-left origin
+                visit(indices + (top + y) * stride + left);
 #endif
+            }
+        }
+    };
 
-            if (curr_code < 0) {
-                // first value in a new run
-                curr_code = next_value;
-            } else if (codetree[curr_code].next[next_value]) {
-                // current run already in the dictionary
-                curr_code = codetree[curr_code].next[next_value];
-            } else {
-                // finish the current run, write a code
-                stat.write_code(f, curr_code, code_size);
-
-                // insert the new run into the dictionary
-                codetree[curr_code].next[next_value] = ++max_code;
-
-                if (max_code >= (1UL << code_size)) {
-                    // dictionary entry count has broken a size barrier,
-                    // we need more bits for codes
-                    code_size++;
-                }
-                if (max_code == 4095) {
-                    // the dictionary is full, clear it out and begin anew
-                    stat.write_code(f, clear_code, code_size); // clear tree
-
-                    memset(codetree.get(), 0,
-                           sizeof(GifLzwNode) * codetree_size);
-                    code_size = min_code_size + 1;
-                    max_code = clear_code + 1;
-                }
-
-                curr_code = next_value;
+    if (compression == COMPRESS_MAX) {
+        auto const size = width * height;
+        auto const data = frame_pool().acquire(size);
+        auto out = data.get();
+        for_each_row([&](u8 const *row) {
+            memcpy(out, row, width);
+            out += width;
+        });
+
+        // lookahead usually saves bits, but not always: its shorter runs use
+        // up dictionary codes that the longer ones would have had
+        auto const greedy_buffer =
+            frame_pool().acquire(lzw_max_codes(size) * sizeof(LzwCode));
+        auto const flexible_buffer =
+            frame_pool().acquire(lzw_max_codes(size) * sizeof(LzwCode));
+        auto const greedy = greedy_buffer.as<LzwCode>();
+        auto const flexible = flexible_buffer.as<LzwCode>();
+
+        auto const greedy_count = lzw_parse(data.get(), size, min_code_size,
+                                            codetree, false, greedy);
+        auto const flexible_count = lzw_parse(data.get(), size, min_code_size,
+                                              codetree, true, flexible);
+
+        auto bits = [](LzwCode const *codes, usize count) {
+            usize total{};
+            for (usize i{}; i < count; ++i) {
+                total += codes[i].size;
             }
+            return total;
+        };
+        auto const [codes, count] =
+            bits(flexible, flexible_count) < bits(greedy, greedy_count)
+                ? std::pair{flexible, flexible_count}
+                : std::pair{greedy, greedy_count};
+
+        for (usize i{}; i < count; ++i) {
+            stat.write_code(f, codes[i].code, codes[i].size);
         }
-    }
+    } else {
+        memset(codetree, 0, sizeof(GifLzwNode) * codetree_size);
+        auto curr_code = -1;
+        auto code_size = static_cast<u32>(min_code_size + 1);
+        auto max_code = clear_code + 1;
+
+        // start with a fresh LZW dictionary
+        stat.write_code(f, clear_code, code_size);
+
+        for_each_row([&](u8 const *row) {
+            for (usize x{}; x < width; ++x) {
+                auto const next_value = row[x];
+
+                if (curr_code < 0) {
+                    // first value in a new run
+                    curr_code = next_value;
+                } else if (codetree[curr_code].next[next_value]) {
+                    // current run already in the dictionary
+                    curr_code = codetree[curr_code].next[next_value];
+                } else {
+                    // finish the current run, write a code
+                    stat.write_code(f, curr_code, code_size);
+
+                    // insert the new run into the dictionary
+                    codetree[curr_code].next[next_value] = ++max_code;
+
+                    if (max_code >= (1UL << code_size)) {
+                        // dictionary entry count has broken a size barrier,
+                        // we need more bits for codes
+                        code_size++;
+                    }
+                    if (max_code == 4095) {
+                        // the dictionary is full, clear it out and begin anew
+                        stat.write_code(f, clear_code, code_size); // clear tree
+
+                        memset(codetree, 0,
+                               sizeof(GifLzwNode) * codetree_size);
+                        code_size = min_code_size + 1;
+                        max_code = clear_code + 1;
+                    }
+
+                    curr_code = next_value;
+                }
+            }
+        });
 
-    // compression footer
-    stat.write_code(f, curr_code, code_size);
-    stat.write_code(f, clear_code, code_size);
-    stat.write_code(f, clear_code + 1, min_code_size + 1);
+        // compression footer
+        stat.write_code(f, curr_code, code_size);
+        stat.write_code(f, clear_code, code_size);
+        stat.write_code(f, clear_code + 1, min_code_size + 1);
+    }
 
     // write out the last partial chunk
     while (stat.bit_index)
@@ -358,27 +1000,174 @@ void write_lzw_image(FILE *f, u8 const *image, usize left, usize top,
     if (stat.chunk_index) stat.write_chunk(f);
 
     fputc(0, f); // image block terminator
+
+    return 1 + stat.written + 1;
+}
+
+// === LzwEstimator methods ===
+
+LzwEstimator::LzwEstimator(int min_code_size)
+    : entries{frame_pool().acquire(sizeof(u32) * table_size)},
+      min_code_size{static_cast<u32>(min_code_size)},
+      code_size{this->min_code_size + 1},
+      max_code{(1U << min_code_size) + 1} {
+    memset(entries.get(), 0, sizeof(u32) * table_size);
+}
+
+void LzwEstimator::add_row(u8 const *row, usize width) {
+    auto const table = entries.as<u32>();
+    auto const clear_code = 1U << min_code_size;
+
+    for (usize x{}; x < width; ++x) {
+        auto const next_value = row[x];
+        if (curr_code < 0) {
+            curr_code = next_value;
+            continue;
+        }
+
+        // find the run and the next value in the table, or the empty slot
+        // where it goes
+        auto const key = static_cast<u32>(curr_code) << 8 | next_value;
+        auto slot = (key * 0x9e3779b1U) >> (32 - table_bits);
+        while (table[slot] != 0 && table[slot] >> 12 != key) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        if (table[slot] != 0) {
+            // current run already in the dictionary
+            curr_code = static_cast<i32>(table[slot] & 0xfff);
+            continue;
+        }
+
+        bits += code_size;
+        table[slot] = key << 12 | ++max_code;
+
+        if (max_code >= (1UL << code_size)) code_size++;
+        if (max_code == 4095) {
+            bits += code_size;
+
+            memset(table, 0, sizeof(u32) * table_size);
+            code_size = min_code_size + 1;
+            max_code = clear_code + 1;
+        }
+
+        curr_code = next_value;
+    }
+}
+
+/// Bytes of image data in the file for `bits` of codes.
+auto lzw_data_bytes(usize bits) -> usize {
+    // the code size, the data in sub-blocks with a size byte in front of each
+    // one, and the block terminator
+    auto const data = (bits + 7) / 8;
+    return 1 + data + (data + 254) / 255 + 1;
+}
+
+auto LzwEstimator::bytes() const -> usize {
+    // the clear code at the start, and the last run, clear and end of
+    // information codes of the footer
+    auto const footer =
+        (curr_code < 0 ? 0 : code_size) + code_size + min_code_size + 1;
+
+    return lzw_data_bytes(min_code_size + 1 + bits + footer);
+}
+
+/// Estimates the bytes of image data of `rect`, with `row(y)` giving the
+/// indices of its row `y`. See `estimate_lzw_size`.
+template <typename F>
+auto estimate_rows(Rect const &rect, int min_code_size, usize max_pixels,
+                   F &&row) -> usize {
+    if (rect.area() <= max_pixels) {
+        LzwEstimator estimator{min_code_size};
+        for (auto y = rect.top; y < rect.bottom(); ++y) {
+            estimator.add_row(row(y), rect.width);
+        }
+        return estimator.bytes();
+    }
+
+    // Compression gets better as the dictionary fills up with what the image
+    // repeats, so each window of rows that is counted comes after twice as
+    // many that only warm the dictionary up, like the rows above it would
+    // have. Starting cold is rare enough in a whole image to be left out
+    static constexpr usize windows = 8;
+    auto const window_rows =
+        max(max_pixels / (windows * 3) / rect.width, usize{1});
+    auto const warm_rows = min(window_rows * 2, rect.height - 1);
+
+    usize bits{};
+    usize pixels{};
+    for (usize window{}; window < windows; ++window) {
+        auto const first =
+            rect.top + warm_rows + window * (rect.height - warm_rows) / windows;
+        auto const last = min(first + window_rows, rect.bottom());
+
+        LzwEstimator estimator{min_code_size};
+        for (auto y = first - warm_rows; y < first; ++y) {
+            estimator.add_row(row(y), rect.width);
+        }
+
+        auto const warm_bits = estimator.bits;
+        for (auto y = first; y < last; ++y) {
+            estimator.add_row(row(y), rect.width);
+        }
+
+        bits += estimator.bits - warm_bits;
+        pixels += (last - first) * rect.width;
+    }
+
+    auto const code_bits = static_cast<usize>(
+        static_cast<double>(bits) * static_cast<double>(rect.area()) /
+        static_cast<double>(pixels));
+
+    // the codes, and at most 12 bits for each of the codes around them
+    return lzw_data_bytes(code_bits + 4 * 12);
+}
+
+auto estimate_lzw_size(u8 const *indices, usize stride, Rect const &rect,
+                       int min_code_size, usize max_pixels) -> usize {
+    return estimate_rows(rect, min_code_size, max_pixels, [&](usize y) {
+        return indices + y * stride + rect.left;
+    });
 }
 
 // === Writer methods ===
 
-auto Writer::open(std::string const &filename, usize width, usize height,
-                  usize delay, int bit_depth, bool dither)
-    -> std::optional<Writer> {
+auto Writer::create(FILE *f, usize width, usize height,
+                    WriterOptions const &options) -> std::optional<Writer> {
     Writer w;
+    w.options = options;
+
+    // what is left on auto is up to this machine
+    auto const &tuning = host_tuning();
+    if (w.options.threads == 0) w.options.threads = tuning.threads;
+    if (w.options.stripe_rows == 0) w.options.stripe_rows = tuning.stripe_rows;
+    if (w.options.search == Search::automatic)
+        w.options.search = tuning.search;
+    if (w.options.palette_pixels == 0)
+        w.options.palette_pixels = tuning.palette_pixels;
+
+    if (options.max_memory != 0) {
+        auto const fixed =
+            memory_needed(width, height, 0, options.compression);
+        if (options.max_memory < fixed + min_palette_pixels * 4) {
+            fprintf(stderr, "A %zux%zu GIF needs at least %zu bytes\n", width,
+                    height, fixed + min_palette_pixels * 4);
+            fclose(f);
+            return std::nullopt;
+        }
 
-    w.f = nullptr;
-    FILE *f{};
-
-#if defined(_MSC_VER) && (_MSC_VER >= 1400)
-    fopen_s(&f, filename.c_str(), "wb");
-#else
-    f = fopen(filename.c_str(), "wb");
-#endif
-    if (!f) return std::nullopt;
+        w.max_palette_pixels = (options.max_memory - fixed) / 4;
+    }
 
-    // allocate
-    w.old_image = std::make_unique<u8[]>(width * height * 4);
+    // allocate, the canvas starts out as all background
+    w.width = width;
+    w.height = height;
+    w.old_image = frame_pool().acquire(width * height * 4);
+    w.prev_image = frame_pool().acquire(width * height * 4);
+    w.indices = frame_pool().acquire(width * height);
+    memset(w.old_image.get(), 0, w.old_image.size);
+    memset(w.prev_image.get(), 0, w.prev_image.size);
+    memset(w.indices.get(), 0, w.indices.size);
     w.f = Writer::File{
         f,
         [](FILE *f) {
@@ -389,6 +1178,26 @@ auto Writer::open(std::string const &filename, usize width, usize height,
         },
     };
 
+    return w;
+}
+
+auto Writer::open(std::string const &filename, usize width, usize height,
+                  usize delay, int bit_depth, bool dither,
+                  WriterOptions const &options) -> std::optional<Writer> {
+    FILE *f{};
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    fopen_s(&f, filename.c_str(), "wb");
+#else
+    f = fopen(filename.c_str(), "wb");
+#endif
+    if (!f) return std::nullopt;
+
+    auto w_ = create(f, width, height, options);
+    if (!w_) return std::nullopt;
+
+    auto w = std::move(*w_);
+
     fputs("GIF89a", w.f.get());
 
     // screen descriptor
@@ -435,33 +1244,542 @@ auto Writer::write_frame(u8 const *image, usize width, usize height,
                          usize delay, int bit_depth, bool dither) -> bool {
     if (!f) return false;
 
-    const uint8_t *old_image = first_frame ? nullptr : this->old_image.get();
-    first_frame = false;
+    // a delta palette starts from the one of the frame before
+    std::optional<Palette> pal;
+    if (options.delta_palette_error != 0 && pending &&
+        pending->pal.bit_depth == bit_depth)
+        pal = pending->pal;
+
+    // now that we know what comes next, the pending frame can be written.
+    // Disposing of it can clear or restore pixels outside of the active area
+    // (the first frame covers all of the canvas), which then have to be
+    // looked at for changes too
+    auto area = active_area();
+    if (pending) {
+        auto const disposal =
+            timed(stats.choosing, [&] { return choose_disposal(image); });
+        if (disposal != DISPOSE_KEEP) area = area.merge(pending->rect);
+        timed(stats.compressing, [&] { flush_pending(disposal); });
+    }
+
+    auto const alpha_threshold = options.alpha_threshold;
+    auto rect = find_changed_area(old_image.get(), image, width, area, {},
+                                  alpha_threshold);
+    ++frame_count;
+
+    // nothing changed, but a frame still needs at least one pixel (which is
+    // going to be transparent)
+    if (rect.empty()) rect = {0, 0, 1, 1};
 
     // make_pallete((dither ? nullptr : old_image), image, width, height,
     //              bit_depth, dither, pal);
-    Palette pal{
-        dither ? nullptr : old_image, image, width, height, bit_depth, dither,
+    auto const max_pixels = min(max_palette_pixels, options.palette_pixels);
+    auto const base = dither ? nullptr : old_image.get();
+    timed(stats.palettes, [&] {
+        auto const replaced =
+            pal ? pal->update(base, image, width, rect,
+                              options.delta_palette_error, max_pixels,
+                              alpha_threshold)
+                : std::nullopt;
+        if (replaced) {
+            ++stats.updated_palettes;
+            if (*replaced == 0) ++stats.kept_palettes;
+        } else {
+            pal.emplace(base, image, width, rect, bit_depth, dither,
+                        max_pixels, alpha_threshold);
+        }
+    });
+
+    if (rect.area() > max_palette_pixels) ++stats.sampled_frames;
+    stats.peak_memory =
+        max(stats.peak_memory,
+            memory_needed(width, height, min(rect.area(), max_pixels),
+                          options.compression));
+
+    timed(stats.mapping, [&] {
+        if (dither)
+            dither_image(old_image.get(), image, old_image.get(),
+                         indices.get(), width, rect, *pal, options.search,
+                         alpha_threshold);
+        else
+            threshold_image(old_image.get(), image, old_image.get(),
+                            indices.get(), width, rect, *pal, options.search,
+                            options.threads, options.stripe_rows,
+                            alpha_threshold);
+    });
+
+    pending = PendingFrame{*pal, rect, delay};
+
+    return true;
+}
+
+auto Writer::choose_disposal(u8 const *image) -> Disposal {
+    auto &rect = pending->rect;
+    auto const alpha_threshold = options.alpha_threshold;
+
+    // pixels going from painted to transparent need the background under them
+    auto const uncovered = alpha_threshold == 0
+                               ? Rect{}
+                               : find_uncovered_area(old_image.get(), image,
+                                                     width, active_area(),
+                                                     alpha_threshold);
+    if (rect.merge(uncovered).area() != rect.area()) {
+        // grow the pending frame over them, with the new part of it
+        // transparent so that it shows the same as before, and clear it all
+        auto const grown = rect.merge(uncovered);
+        for (auto const &band : around(rect, grown)) {
+            for (auto y = band.top; y < band.bottom(); ++y) {
+                memset(indices.get() + y * width + band.left,
+                       transparency_index, band.width);
+            }
+        }
+
+        rect = grown;
+        return DISPOSE_BACKGROUND;
+    }
+
+    // Outside of the pending frame's rectangle all disposal methods leave the
+    // same thing on the canvas, so the changes there are shared by all of them.
+    Rect outside;
+    for (auto const &band : around(rect, active_area())) {
+        if (band.empty()) continue;
+        outside = outside.merge(find_changed_area(old_image.get(), image, width,
+                                                  band, {}, alpha_threshold));
+    }
+
+    struct Candidate {
+        Disposal disposal;
+        Rect changed;
+        /// Whether it leaves painted pixels under transparent ones.
+        bool uncovers;
+    };
+
+    Candidate const candidates[] = {
+        {DISPOSE_KEEP,
+         find_changed_area(old_image.get(), image, width, rect, {},
+                           alpha_threshold),
+         !uncovered.empty()},
+        {DISPOSE_PREVIOUS,
+         find_changed_area(prev_image.get(), image, width, rect, {},
+                           alpha_threshold),
+         alpha_threshold != 0 &&
+             !find_uncovered_area(prev_image.get(), image, width, rect,
+                                  alpha_threshold)
+                  .empty()},
+        {DISPOSE_BACKGROUND,
+         find_changed_area(old_image.get(), image, width, rect, rect,
+                           alpha_threshold),
+         false},
     };
 
-    if (dither)
-        dither_image(old_image, image, this->old_image.get(), width, height,
-                     pal);
-    else
-        threshold_image(old_image, image, this->old_image.get(), width, height,
-                        pal);
+    // The one that needs the least pixels to be encoded wins, unless another
+    // one is estimated to give a next frame that is clearly smaller in bytes:
+    // the pixels that stay the same as the canvas are transparent, and long
+    // runs of them cost next to nothing. Estimates only look one frame ahead,
+    // while a larger frame tends to stay large for the ones after it, hence
+    // the margin of 1/32. In case of a tie the ones earlier in the list are
+    // preferred
+    struct Choice {
+        Disposal disposal = DISPOSE_KEEP;
+        usize area = ~usize{};
+        usize size = ~usize{};
+    };
+    Choice least_pixels;
+    Choice least_bytes;
+    for (auto const &[disposal, changed, uncovers] : candidates) {
+        if (uncovers) continue;
+
+        auto const next = outside.merge(changed);
+        auto const choice = Choice{disposal, next.area(),
+                                   estimate_next_size(image, disposal, next)};
+        if (choice.area < least_pixels.area) least_pixels = choice;
+        if (choice.size < least_bytes.size) least_bytes = choice;
+    }
 
-    write_lzw_image(f.get(), this->old_image.get(), 0, 0, width, height, delay,
-                    pal);
+    return least_bytes.size + least_bytes.size / 32 < least_pixels.size
+               ? least_bytes.disposal
+               : least_pixels.disposal;
+}
+
+auto Writer::estimate_next_size(u8 const *image, Disposal disposal,
+                                Rect const &area) const -> usize {
+    auto const &rect = pending->rect;
+    auto const alpha_threshold = options.alpha_threshold;
+    static constexpr u8 background[4] = {};
+
+    // a row is small (often a cursor wide) and short-lived, it doesn't need to
+    // go through the pool
+    std::vector<u8> row_buffer(area.width);
+    auto const row = row_buffer.data();
+
+    return estimate_rows(area, 8, lzw_estimate_pixels, [&](usize y) {
+        auto const in_rect = y >= rect.top && y < rect.bottom();
+
+        for (usize i{}; i < area.width; ++i) {
+            auto const x = area.left + i;
+            auto const offset = (y * width + x) * 4;
+            auto const pixel = image + offset;
+
+            // what the canvas shows there after the disposal
+            auto const *base = old_image.get() + offset;
+            if (in_rect && x >= rect.left && x < rect.right()) {
+                if (disposal == DISPOSE_BACKGROUND) base = background;
+                if (disposal == DISPOSE_PREVIOUS)
+                    base = prev_image.get() + offset;
+            }
+
+            if (transparent(pixel, alpha_threshold) ||
+                !pixel_changed(base, pixel, alpha_threshold)) {
+                row[i] = transparency_index;
+            } else {
+                // 3 bits of red and green, 2 of blue
+                auto const color = (pixel[RED] & 0xe0) |
+                                   (pixel[GREEN] >> 3 & 0x1c) |
+                                   pixel[BLUE] >> 6;
+                row[i] = static_cast<u8>(max(color, 1));
+            }
+        }
+
+        return row;
+    });
+}
+
+void Writer::flush_pending(Disposal disposal) {
+    auto const &rect = pending->rect;
+    auto const estimate =
+        options.check_estimates
+            ? estimate_lzw_size(indices.get(), width, rect,
+                                pending->pal.bit_depth)
+            : 0;
+    auto const written =
+        write_lzw_image(f.get(), indices.get(), width, rect, pending->delay,
+                        disposal, options.interlace, pending->pal,
+                        options.compression);
+
+    if (options.check_estimates) {
+        auto const error =
+            estimate > written ? estimate - written : written - estimate;
+        stats.lzw_bytes += written;
+        stats.estimate_error += error;
+        stats.max_estimate_error =
+            max(stats.max_estimate_error,
+                static_cast<double>(error) / static_cast<double>(written));
+    }
+
+    // bring the canvas to what the viewer will show after the disposal, and
+    // keep `prev_image` in sync with it for the next frame
+    switch (disposal) {
+    case DISPOSE_KEEP: break;
+    case DISPOSE_BACKGROUND: clear_rect(old_image.get(), width, rect); break;
+    case DISPOSE_PREVIOUS:
+        copy_rect(old_image.get(), prev_image.get(), width, rect);
+        break;
+    }
+    copy_rect(prev_image.get(), old_image.get(), width, rect);
+
+    pending = std::nullopt;
+}
+
+auto Writer::memory_needed(usize width, usize height, usize palette_pixels,
+                           Compression compression) -> usize {
+    // `old_image` and `prev_image` are RGBA, `indices` a byte per pixel
+    auto const canvas = width * height * 9;
+    auto const codetree = sizeof(GifLzwNode) * codetree_size;
+    // two rows of dithering error
+    auto const dither = width * 4 * sizeof(i32) * 2;
+    // the table of `Search::cache`
+    auto const lookup = (usize{1} << ColorLookup::cache_bits) * sizeof(u32);
+
+    // the gathered indices and both parses of `COMPRESS_MAX`
+    auto const parses = compression == COMPRESS_MAX
+                            ? width * height +
+                                  lzw_max_codes(width * height) *
+                                      sizeof(LzwCode) * 2
+                            : 0;
+
+    return canvas + codetree + palette_pixels * 4 + dither + lookup + parses;
+}
+
+auto Writer::active_area() const -> Rect {
+    auto const canvas = Rect{0, 0, width, height};
+
+    // the first frame is drawn over the background, so all of it is new
+    if (frame_count == 0 || options.active_area.empty()) return canvas;
+    return options.active_area.intersect(canvas);
+}
+
+// === checkpoints ===
+
+/// Identifies checkpoint files, and the version of their layout.
+static constexpr char checkpoint_magic[] = "giffer checkpoint 2\n";
+
+/// Writes the bytes of a value to a checkpoint. Checkpoints are only meant
+/// to be resumed on the machine that saved them, so nothing is converted.
+template <typename T>
+auto write_value(FILE *f, T const &value) -> bool {
+    return fwrite(&value, sizeof(value), 1, f) == 1;
+}
+
+/// Reads a value written by `write_value`.
+template <typename T>
+auto read_value(FILE *f, T &value) -> bool {
+    return fread(&value, sizeof(value), 1, f) == 1;
+}
+
+auto write_rect(FILE *f, Rect const &rect) -> bool {
+    return write_value(f, u64{rect.left}) && write_value(f, u64{rect.top}) &&
+           write_value(f, u64{rect.width}) && write_value(f, u64{rect.height});
+}
+
+auto read_rect(FILE *f, Rect &rect) -> bool {
+    u64 left;
+    u64 top;
+    u64 width;
+    u64 height;
+    if (!read_value(f, left) || !read_value(f, top) || !read_value(f, width) ||
+        !read_value(f, height))
+        return false;
+
+    rect = {left, top, width, height};
+    return true;
+}
+
+/// Makes sure that everything written to `f` is on disk.
+auto sync_file(FILE *f) -> bool {
+    if (fflush(f) != 0) return false;
+
+#if defined(_MSC_VER)
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+auto Writer::save_checkpoint(std::string const &path,
+                             Checkpoint const &checkpoint) -> bool {
+    if (!f) return false;
+
+    // the checkpoint points into the GIF, so it must be there first
+    if (!sync_file(f.get())) return false;
+    auto const offset = ftell(f.get());
+    if (offset < 0) return false;
+
+    // written next to the old one and renamed over it once complete
+    auto const temp_path = path + ".tmp";
+    auto out = std::unique_ptr<FILE, int (*)(FILE *)>{
+        fopen(temp_path.c_str(), "wb"), fclose};
+    if (!out) return false;
+
+    using RawPalette = array<std::byte, sizeof(Palette)>;
+
+    auto ok =
+        fwrite(checkpoint_magic, sizeof(checkpoint_magic), 1, out.get()) ==
+            1 &&
+        write_value(out.get(), u64{width}) &&
+        write_value(out.get(), u64{height}) &&
+        write_value(out.get(), static_cast<u64>(offset)) &&
+        write_value(out.get(), u64{frame_count}) &&
+        write_value(out.get(), u64{checkpoint.position}) &&
+        write_value(out.get(), u64{checkpoint.settings.size()}) &&
+        fwrite(checkpoint.settings.data(), 1, checkpoint.settings.size(),
+               out.get()) == checkpoint.settings.size() &&
+        write_value(out.get(), u8{pending.has_value()});
+
+    if (ok && pending) {
+        ok = write_rect(out.get(), pending->rect) &&
+             write_value(out.get(), u64{pending->delay}) &&
+             write_value(out.get(), std::bit_cast<RawPalette>(pending->pal));
+    }
+
+    ok = ok &&
+         fwrite(old_image.get(), 1, old_image.size, out.get()) ==
+             old_image.size &&
+         fwrite(prev_image.get(), 1, prev_image.size, out.get()) ==
+             prev_image.size &&
+         fwrite(indices.get(), 1, indices.size, out.get()) == indices.size &&
+         sync_file(out.get());
+
+    out = nullptr;
+    if (!ok || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::remove(temp_path.c_str());
+        return false;
+    }
 
     return true;
 }
 
+/// The start of a checkpoint, up to the state of the pending frame.
+struct CheckpointHeader {
+    u64 width;
+    u64 height;
+    /// Size of the GIF when the checkpoint was saved.
+    u64 offset;
+    u64 frame_count;
+};
+
+/// Opens the checkpoint at `path` and reads its header, leaving the file
+/// right after it.
+auto open_checkpoint(std::string const &path, CheckpointHeader &header,
+                     Writer::Checkpoint &checkpoint)
+    -> std::unique_ptr<FILE, int (*)(FILE *)> {
+    auto in = std::unique_ptr<FILE, int (*)(FILE *)>{
+        fopen(path.c_str(), "rb"), fclose};
+    if (!in) {
+        fprintf(stderr, "Error opening checkpoint: %s\n", path.c_str());
+        return in;
+    }
+
+    char magic[sizeof(checkpoint_magic)];
+    u64 position;
+    u64 settings_size;
+    auto ok = fread(magic, sizeof(magic), 1, in.get()) == 1 &&
+              memcmp(magic, checkpoint_magic, sizeof(magic)) == 0 &&
+              read_value(in.get(), header.width) &&
+              read_value(in.get(), header.height) &&
+              read_value(in.get(), header.offset) &&
+              read_value(in.get(), header.frame_count) &&
+              read_value(in.get(), position) &&
+              read_value(in.get(), settings_size) &&
+              settings_size <= (1 << 20) && header.width <= 0xffff &&
+              header.height <= 0xffff;
+
+    if (ok) {
+        checkpoint.position = position;
+        checkpoint.settings.resize(settings_size);
+        ok = fread(checkpoint.settings.data(), 1, settings_size, in.get()) ==
+             settings_size;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Invalid checkpoint: %s\n", path.c_str());
+        in = nullptr;
+    }
+    return in;
+}
+
+auto Writer::read_checkpoint(std::string const &path)
+    -> std::optional<Checkpoint> {
+    CheckpointHeader header;
+    Checkpoint checkpoint;
+    if (!open_checkpoint(path, header, checkpoint)) return std::nullopt;
+
+    return checkpoint;
+}
+
+auto Writer::resume(std::string const &filename, std::string const &path,
+                    WriterOptions const &options, Checkpoint &checkpoint)
+    -> std::optional<Writer> {
+    CheckpointHeader header;
+    auto const in = open_checkpoint(path, header, checkpoint);
+    if (!in) return std::nullopt;
+
+    auto invalid = [&] {
+        fprintf(stderr, "Invalid checkpoint: %s\n", path.c_str());
+        return std::nullopt;
+    };
+
+    auto const [width, height, offset, frame_count] = header;
+
+    u8 has_pending;
+    std::optional<PendingFrame> pending;
+    if (!read_value(in.get(), has_pending)) return invalid();
+    if (has_pending) {
+        Rect rect;
+        u64 delay;
+        array<std::byte, sizeof(Palette)> raw;
+        // compared without adding, which could wrap
+        if (!read_rect(in.get(), rect) || !read_value(in.get(), delay) ||
+            !read_value(in.get(), raw) || rect.left > width ||
+            rect.width > width - rect.left || rect.top > height ||
+            rect.height > height - rect.top)
+            return invalid();
+
+        pending = PendingFrame{std::bit_cast<Palette>(raw), rect, delay};
+        if (!pending->pal.valid()) return invalid();
+    }
+
+    // all of the checkpoint is read before touching the GIF
+    auto old_image = frame_pool().acquire(width * height * 4);
+    auto prev_image = frame_pool().acquire(width * height * 4);
+    auto indices = frame_pool().acquire(width * height);
+    if (fread(old_image.get(), 1, old_image.size, in.get()) !=
+            old_image.size ||
+        fread(prev_image.get(), 1, prev_image.size, in.get()) !=
+            prev_image.size ||
+        fread(indices.get(), 1, indices.size, in.get()) != indices.size)
+        return invalid();
+
+    // the pending frame is written from its indices, which have to be in its
+    // palette
+    if (pending) {
+        auto const &rect = pending->rect;
+        auto const entries = usize{1} << pending->pal.bit_depth;
+        for (auto y = rect.top; y < rect.bottom(); ++y) {
+            auto const row = indices.get() + y * width + rect.left;
+            for (usize x{}; x < rect.width; ++x) {
+                if (row[x] >= entries) return invalid();
+            }
+        }
+    }
+
+    // the GIF is cut back to where it was when the checkpoint was saved
+    FILE *f{};
+#if defined(_MSC_VER) && (_MSC_VER >= 1400)
+    fopen_s(&f, filename.c_str(), "r+b");
+#else
+    f = fopen(filename.c_str(), "r+b");
+#endif
+    if (!f) {
+        fprintf(stderr, "Error opening output file: %s\n", filename.c_str());
+        return std::nullopt;
+    }
+
+#if defined(_MSC_VER)
+    auto const truncated = _chsize_s(_fileno(f), offset) == 0;
+#else
+    auto const truncated =
+        ftruncate(fileno(f), static_cast<off_t>(offset)) == 0;
+#endif
+    if (!truncated || fseek(f, 0, SEEK_END) != 0 ||
+        static_cast<u64>(ftell(f)) != offset) {
+        fprintf(stderr, "%s is shorter than its checkpoint\n",
+                filename.c_str());
+        fclose(f);
+        return std::nullopt;
+    }
+
+    auto w_ = create(f, width, height, options);
+    if (!w_) return std::nullopt;
+
+    auto w = std::move(*w_);
+    w.frame_count = frame_count;
+    w.pending = pending;
+    w.old_image = std::move(old_image);
+    w.prev_image = std::move(prev_image);
+    w.indices = std::move(indices);
+
+    return w;
+}
+
+auto Writer::output_bytes() const -> usize {
+    if (!f) return stats.output_bytes;
+
+    auto const position = ftell(f.get());
+    return position < 0 ? 0 : static_cast<usize>(position);
+}
+
 auto Writer::close() -> bool {
     if (!f) return false;
 
+    if (pending)
+        timed(stats.compressing, [&] { flush_pending(DISPOSE_KEEP); });
+
+    // with the end of file that closing adds
+    stats.output_bytes = output_bytes() + 1;
     f = nullptr;
-    old_image = nullptr;
+    old_image.release();
+    prev_image.release();
+    indices.release();
 
     return true;
 }
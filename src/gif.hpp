@@ -1,5 +1,9 @@
 #pragma once
 
+#include "buffer_pool.hpp"
+#include "metrics.hpp"
+#include "types.hpp"
+
 #include <array>
 #include <cstdint>
 #include <cstdio>
@@ -7,21 +11,11 @@
 #include <cstring>
 #include <memory>
 #include <optional>
+#include <string>
 #include <tuple>
 
 namespace uppr::gif {
 
-// === typedefs ===
-using u8 = std::uint8_t;
-using i8 = std::int8_t;
-using u16 = std::uint16_t;
-using i16 = std::int16_t;
-using u32 = std::uint32_t;
-using i32 = std::int32_t;
-using u64 = std::uint64_t;
-using i64 = std::int64_t;
-using usize = std::size_t;
-
 using std::array;
 
 using Coloru32 = std::tuple<u32, u32, u32>;
@@ -45,6 +39,65 @@ constexpr auto abs(T i) -> T {
     return i < 0 ? -i : i;
 }
 
+// === canvas geometry ===
+
+/// A rectangle inside of the canvas, in pixels.
+struct Rect {
+    usize left = 0;
+    usize top = 0;
+    usize width = 0;
+    usize height = 0;
+
+    constexpr auto right() const -> usize { return left + width; }
+    constexpr auto bottom() const -> usize { return top + height; }
+    constexpr auto area() const -> usize { return width * height; }
+    constexpr auto empty() const -> bool { return area() == 0; }
+
+    /// Smallest rectangle that contains both `this` and `o`. Empty rectangles
+    /// are ignored.
+    constexpr auto merge(Rect const &o) const -> Rect {
+        if (o.empty()) return *this;
+        if (empty()) return o;
+
+        auto const l = min(left, o.left);
+        auto const t = min(top, o.top);
+        return {l, t, max(right(), o.right()) - l,
+                max(bottom(), o.bottom()) - t};
+    }
+
+    /// The part of `this` that is also inside of `o`.
+    constexpr auto intersect(Rect const &o) const -> Rect {
+        auto const l = max(left, o.left);
+        auto const t = max(top, o.top);
+        auto const r = min(right(), o.right());
+        auto const b = min(bottom(), o.bottom());
+        if (l >= r || t >= b) return {};
+
+        return {l, t, r - l, b - t};
+    }
+};
+
+/// What a viewer should do with the area of a frame before drawing the next
+/// one. Written in the graphics control extension of each frame.
+enum Disposal : u8 {
+    /// Leave the frame in place, the next one is drawn on top of it.
+    DISPOSE_KEEP = 1,
+    /// Clear the area of the frame to the background (transparent).
+    DISPOSE_BACKGROUND = 2,
+    /// Restore the area of the frame to what was there before it.
+    DISPOSE_PREVIOUS = 3,
+};
+
+/// How hard the LZW compression of the frames tries.
+enum Compression {
+    /// Each code is the longest run of indices in the dictionary.
+    COMPRESS_FAST,
+    /// Also tries taking shorter runs when that lets the next one reach
+    /// further, and keeps whichever of both is smaller. Saves up to a few
+    /// percent on flat content, for a second pass over the indices.
+    COMPRESS_MAX,
+};
+
 // === image buffer management ===
 
 /// Typed way of defining the index into the buffer that will store the colors
@@ -224,38 +277,95 @@ constexpr void partition_by_median(u8 *image, usize left, usize right,
     }
 }
 
+/// Sorts the pixels around the median of the color with the largest range, so
+/// that the first `count` of them are the darkest in that color. Gives the
+/// color that was sorted by.
+constexpr auto split_by_largest_range(u8 *image, usize num_pixels, usize count)
+    -> u8 {
+    auto const [r_range, g_range, b_range] =
+        find_largest_range(image, num_pixels);
+
+    // (incidentally, this means the tree built from these splits isn't a
+    // "proper" k-d tree but I don't know what else to call it)
+    u8 split_com = 1;
+    if (b_range > g_range) split_com = 2;
+    if (r_range > b_range && r_range > g_range) split_com = 0;
+
+    partition_by_median(image, 0, num_pixels, split_com, count);
+
+    return split_com;
+}
+
 // === pallete building ===
 
 /// Structure to store the pallete that will be generated for an image.
 struct Palette {
     int bit_depth;
 
-    array<u8, 256> r;
-    array<u8, 256> g;
-    array<u8, 256> b;
+    array<u8, 256> r{};
+    array<u8, 256> g{};
+    array<u8, 256> b{};
 
     /// k-d tree over RGB space, organized in heap fashion
     ///
     /// i.e. left child of node i is node i*2, right child is node i*2+1 nodes
     /// 256-511 are implicitly the leaves, containing a color
-    array<u8, 256> tree_split_elt;
-    array<u8, 256> tree_split;
-
-    /// Creates a palette by placing all the image pixels in a k-d tree and then
-    /// averaging the blocks at the bottom. This is known as the "modified
-    /// median split" technique
+    array<u8, 256> tree_split_elt{};
+    array<u8, 256> tree_split{};
+    /// Palette entry of each leaf, leaf i being node `(1 << bit_depth) + i`.
+    /// A new palette has entry i at leaf i, an updated one keeps its entries
+    /// where they were and moves the leaves around them instead.
+    array<u8, 256> leaf{};
+
+    /// Pixels that `update` checks the palette against at most.
+    static constexpr usize update_pixels = 1 << 14;
+    /// A new palette is built instead when more than one in this many pixels
+    /// are served poorly.
+    static constexpr usize update_poor_share = 4;
+    /// How many times as far as the closest color the color picked by an
+    /// approximate search can be.
+    static constexpr int approx_factor = 2;
+
+    /// Creates a palette by placing all the image pixels inside of `rect` in a
+    /// k-d tree and then averaging the blocks at the bottom. This is known as
+    /// the "modified median split" technique
+    ///
+    /// When `rect` has more than `max_pixels` pixels, the tree is built from
+    /// evenly spaced samples of it, to bound the memory used. Pixels with an
+    /// alpha below `alpha_threshold` are transparent, and left out.
     Palette(u8 const *last_frame, u8 const *next_frame, usize width,
-            usize height, int bit_depth, bool build_for_dither);
+            Rect const &rect, int bit_depth, bool build_for_dither,
+            usize max_pixels = SIZE_MAX, u8 alpha_threshold = 0);
+
+    /// Updates the palette for the pixels that the constructor would build a
+    /// new one from. A color serves a pixel well when they are at most
+    /// `max_error` apart (summed over RGB). The entries that serve none of the
+    /// pixels well are replaced by colors of the pixels that are served
+    /// poorly, and the other entries keep their index.
+    ///
+    /// Only samples up to `update_pixels` of the pixels are checked. Gives how
+    /// many entries were replaced, or nothing (leaving the palette as it was)
+    /// when too many of the pixels are served poorly, no entry is free, or the
+    /// replaced entries still leave some of them more than `max_error` off: a
+    /// new palette is better then.
+    auto update(u8 const *last_frame, u8 const *next_frame, usize width,
+                Rect const &rect, int max_error, usize max_pixels = SIZE_MAX,
+                u8 alpha_threshold = 0) -> std::optional<usize>;
 
     /// walks the k-d tree to pick the palette entry for a desired color. Takes
     /// as in/out parameters the current best color and its error - only changes
     /// them if it finds a better color in its subtree. this is the major
     /// hotspot in the code at the moment.
+    ///
+    /// With `approx`, the far side of a split is only checked when a color
+    /// there could be closer by a factor of `approx_factor`, so the color
+    /// picked is at most that many times as far as the closest one.
+    template <bool approx = false>
     constexpr void get_closest_pallete_color(int r, int g, int b, int &best_ind,
                                              int &best_diff, int tree_root) {
         // base case, reached the bottom of the tree
         if (tree_root > (1 << bit_depth) - 1) {
-            auto const ind = tree_root - (1 << bit_depth);
+            auto const ind = leaf[tree_root - (1 << bit_depth)];
             if (ind == transparency_index) return;
 
             // check whether this color is better than the current winner
@@ -276,23 +386,29 @@ struct Palette {
         array comps{r, g, b};
         auto const split_comp = comps[tree_split_elt[tree_root]];
 
+        // how far the colors on the other side of the split are at least,
+        // or for an approximate search how far they would have to be
+        auto const far_side = [](int distance) {
+            return approx ? distance * approx_factor : distance;
+        };
+
         auto const split_pos = tree_split[tree_root];
         if (split_pos > split_comp) {
             // check the left subtree
-            get_closest_pallete_color(r, g, b, best_ind, best_diff,
-                                      tree_root * 2);
-            if (best_diff > split_pos - split_comp) {
+            get_closest_pallete_color<approx>(r, g, b, best_ind, best_diff,
+                                              tree_root * 2);
+            if (best_diff > far_side(split_pos - split_comp)) {
                 // cannot prove there's not a better value in the right subtree,
                 // check that too
-                get_closest_pallete_color(r, g, b, best_ind, best_diff,
-                                          tree_root * 2 + 1);
+                get_closest_pallete_color<approx>(r, g, b, best_ind, best_diff,
+                                                  tree_root * 2 + 1);
             }
         } else {
-            get_closest_pallete_color(r, g, b, best_ind, best_diff,
-                                      tree_root * 2 + 1);
-            if (best_diff > split_comp - split_pos) {
-                get_closest_pallete_color(r, g, b, best_ind, best_diff,
-                                          tree_root * 2);
+            get_closest_pallete_color<approx>(r, g, b, best_ind, best_diff,
+                                              tree_root * 2 + 1);
+            if (best_diff > far_side(split_comp - split_pos)) {
+                get_closest_pallete_color<approx>(r, g, b, best_ind, best_diff,
+                                                  tree_root * 2);
             }
         }
     }
@@ -345,21 +461,13 @@ struct Palette {
             return;
         }
 
-        // Find the axis with the largest range
-        auto const [r_range, g_range, b_range] =
-            find_largest_range(image, num_pixels);
-
-        // and split along that axis. (incidentally, this means this isn't a
-        // "proper" k-d tree but I don't know what else to call it)
-        auto split_com = 1;
-        if (b_range > g_range) split_com = 2;
-        if (r_range > b_range && r_range > g_range) split_com = 0;
-
+        // split along the axis with the largest range
         auto const sub_pixels_a =
             num_pixels * (split_elt - first_elt) / (last_elt - first_elt);
         auto const sub_pixels_b = num_pixels - sub_pixels_a;
 
-        partition_by_median(image, 0, num_pixels, split_com, sub_pixels_a);
+        auto const split_com =
+            split_by_largest_range(image, num_pixels, sub_pixels_a);
 
         tree_split_elt[tree_node] = split_com;
         tree_split[tree_node] = image[sub_pixels_a * 4 + split_com];
@@ -371,10 +479,71 @@ struct Palette {
               build_for_dither);
     }
 
+    /// Sets the entries in `entries` to the averages of `count` groups of the
+    /// pixels, split like the tree splits them.
+    void place_colors(u8 *image, usize num_pixels, u8 const *entries,
+                      usize count);
+
+    /// Builds the tree over the entries of the palette, moving the leaves to
+    /// where the entries are.
+    void sort_entries();
+
+    /// Splits `entries` (one pixel per entry, with its index in place of the
+    /// alpha) like `split` splits pixels, down to one entry per leaf.
+    void sort_leaves(u8 *entries, usize first_elt, usize last_elt,
+                     usize split_elt, usize split_dist, usize tree_node);
+
     /// write a 256-color (8-bit) image palette to the file
     void write(FILE *f) const;
+
+    /// Whether the bit depth, tree and leaves only hold values that the tree
+    /// search and `write_lzw_image` can use, for palettes read back from a
+    /// checkpoint.
+    auto valid() const -> bool;
+};
+
+// === pixel mapping ===
+
+/// How the closest palette color of a pixel is found.
+enum class Search {
+    /// Whatever the tuning profile of the machine says.
+    automatic,
+    /// Walk the k-d tree of the palette for every pixel.
+    tree,
+    /// Walk the tree, but remember the colors already found in a small table.
+    /// Faster for images that repeat the same colors a lot, like UI or flat
+    /// art, and the same result.
+    cache,
+    /// Walk the tree, but skip the parts of it that can only hold colors a
+    /// little closer than the best one found so far (see
+    /// `Palette::get_closest_pallete_color`). Faster, but not always the
+    /// closest color, so unlike the others it changes the GIF.
+    approx,
 };
 
+/// Implements Floyd-Steinberg dithering inside of `rect`, writes palette
+/// values to `out_indices`
+///
+/// Pixels of `next_frame` with an alpha below `alpha_threshold` get the
+/// transparency index without a search. The canvas under them (`last_frame`)
+/// has to be background already.
+void dither_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
+                  u8 *out_indices, usize width, Rect const &rect,
+                  Palette &pal, Search search = Search::tree,
+                  u8 alpha_threshold = 0);
+
+/// Picks palette colors for the image inside of `rect` using simple
+/// thresholding, no dithering
+///
+/// The rows are mapped in stripes of `stripe_rows`, by up to `threads` threads
+/// at once. Each pixel is mapped on its own, so the result is the same for any
+/// number of threads. Transparent pixels are handled like in `dither_image`.
+void threshold_image(u8 const *last_frame, u8 const *next_frame, u8 *out_frame,
+                     u8 *out_indices, usize width, Rect const &rect,
+                     Palette &pal, Search search = Search::tree,
+                     usize threads = 1, usize stripe_rows = 64,
+                     u8 alpha_threshold = 0);
+
 // === compression handling ===
 
 /// Simple structure to write out the LZW-compressed portion of the image one
@@ -386,6 +555,9 @@ struct BitStatus {
     u8 byte = 0;
 
     u32 chunk_index = 0;
+    /// how many bytes have been written to the file, with the size byte in
+    /// front of each chunk
+    usize written = 0;
     /// bytes are written in here until we have 256 of them, then written to the
     /// file
     array<u8, 256> chunk;
@@ -413,21 +585,210 @@ struct BitStatus {
     void write_code(FILE *f, u32 code, u32 length);
 };
 
+/// Estimates how big LZW data gets without writing it, by running the greedy
+/// encoder of `write_lzw_image` and only counting the bits of its codes. Rows
+/// are given one at a time, so that callers can stop early or make them up as
+/// they go.
+struct LzwEstimator {
+    explicit LzwEstimator(int min_code_size);
+
+    /// Compresses the next `width` indices of the image.
+    void add_row(u8 const *row, usize width);
+
+    /// Bytes of image data that the rows given so far take in the file, with
+    /// the code size before it and the sizes of its sub-blocks.
+    auto bytes() const -> usize;
+
+    /// The dictionary, as a hash table of `run << 20 | next << 12 | code`
+    /// (0 for empty slots), which is a lot faster to clear than the tree of
+    /// the encoder. Holds all 4096 codes at half its size.
+    static constexpr usize table_bits = 13;
+    static constexpr usize table_size = usize{1} << table_bits;
+    Buffer entries;
+
+    u32 min_code_size;
+    u32 code_size;
+    u32 max_code;
+    i32 curr_code = -1;
+
+    /// Bits of the codes so far.
+    usize bits = 0;
+};
+
+/// How many pixels `estimate_lzw_size` compresses at most.
+constexpr usize lzw_estimate_pixels = 1 << 17;
+
+/// Estimates how many bytes of image data `write_lzw_image` writes for the
+/// `min_code_size` bit indices inside of `rect` of a canvas that is `stride`
+/// pixels wide. Rectangles up to `max_pixels` get the exact size of greedy
+/// compression. Larger ones are sampled: windows of rows spread over them are
+/// compressed, and their bits per pixel taken for the whole. Interlacing is
+/// not taken into account.
+auto estimate_lzw_size(u8 const *indices, usize stride, Rect const &rect,
+                       int min_code_size,
+                       usize max_pixels = lzw_estimate_pixels) -> usize;
+
+/// Finds the part of a sequence of frames that ever changes. Everything outside
+/// of it stays the same as in the first frame for the whole sequence, like
+/// letterboxing or static UI chrome.
+struct ActiveArea {
+    usize width = 0;
+    usize height = 0;
+
+    /// Pixels with an alpha below this are transparent, see `WriterOptions`.
+    u8 alpha_threshold = 0;
+
+    Buffer first_frame;
+    Rect area;
+
+    ActiveArea(u8 const *first_frame, usize width, usize height,
+               u8 alpha_threshold = 0);
+
+    /// Grows the area to contain everything that differs between `image` and
+    /// the first frame.
+    void add_frame(u8 const *image);
+};
+
+/// Optional settings of the `Writer`.
+struct WriterOptions {
+    /// Part of the canvas that can change after the first frame, as found by
+    /// `ActiveArea`. Frames after the first only look inside of it. Empty
+    /// means the whole canvas.
+    Rect active_area;
+
+    /// Write the rows of each frame interlaced, so that viewers can show all
+    /// of it at low detail before it has been fully loaded.
+    bool interlace = false;
+
+    /// Most bytes the writer's buffers can take, 0 for no limit. Frames too
+    /// large to build their palette from a full copy within it get their
+    /// palette built from samples instead.
+    usize max_memory = 0;
+
+    /// Pixels of the frames with an alpha below this are transparent: they show
+    /// the background, and don't take part in the palette. 0 ignores the alpha
+    /// of the frames.
+    u8 alpha_threshold = 0;
+
+    /// How hard the LZW compression tries.
+    Compression compression = COMPRESS_FAST;
+
+    /// Update the palette of the previous frame for each frame (see
+    /// `Palette::update`) instead of building a new one, when it serves the
+    /// frame within this error with a few colors replaced. 0 builds a new
+    /// palette for each frame.
+    int delta_palette_error = 0;
+
+    /// Also estimate the size of each frame with `estimate_lzw_size` before
+    /// writing it, to see how far off the estimates are in `Writer::stats`.
+    bool check_estimates = false;
+
+    // The settings below are left to the tuning profile of the machine (see
+    // `host_tuning`) when they are 0 or automatic. Only `palette_pixels`
+    // changes the GIF, the others give the same bytes for any value (which
+    // `verify_determinism` checks).
+
+    /// Threads mapping the pixels of a frame to its palette. Only used without
+    /// dithering, which carries the error of each pixel over to the next one.
+    usize threads = 0;
+    /// How many rows each of those threads maps at a time.
+    usize stripe_rows = 0;
+    /// How the closest palette colors are found.
+    Search search = Search::automatic;
+    /// Palettes of frames with more pixels than this are built from evenly
+    /// spaced samples of them.
+    usize palette_pixels = 0;
+};
+
 /// The min interface for generating Gif files.
+///
+/// Frames are written one behind: the disposal method of a frame can only be
+/// chosen once the frame that comes after it is known, so the last frame given
+/// to `write_frame` is kept pending until the next one (or `close`) arrives.
 struct Writer {
-    using OwnedImage = std::unique_ptr<u8[]>;
     using File = std::unique_ptr<FILE, void (*)(FILE *f)>;
 
+    /// A frame that has been palettized but not yet written to the file.
+    struct PendingFrame {
+        Palette pal;
+        Rect rect;
+        usize delay;
+    };
+
     File f = {nullptr, nullptr};
-    OwnedImage old_image = nullptr;
-    bool first_frame = true;
+
+    usize width = 0;
+    usize height = 0;
+
+    /// What a viewer shows after the pending frame has been drawn. Alpha is
+    /// 255 for pixels that have been painted and 0 for background.
+    Buffer old_image;
+    /// What a viewer showed before the pending frame has been drawn. Only
+    /// differs from `old_image` inside of the pending frame's rectangle.
+    Buffer prev_image;
+    /// Palette indices of the pending frame, one byte per pixel.
+    Buffer indices;
+
+    WriterOptions options;
+    /// How many frames have been given to `write_frame`.
+    usize frame_count = 0;
+
+    std::optional<PendingFrame> pending;
+
+    /// How the writer has been doing.
+    struct Stats {
+        /// Most bytes taken by the writer's buffers at once.
+        usize peak_memory = 0;
+        /// Frames that had their palette built from samples, to stay within
+        /// `WriterOptions::max_memory`.
+        usize sampled_frames = 0;
+        /// With `WriterOptions::delta_palette_error`, frames that got an
+        /// updated palette, and how many of those kept all of its colors.
+        usize updated_palettes = 0;
+        usize kept_palettes = 0;
+        /// With `WriterOptions::check_estimates`, the bytes of image data
+        /// written, and by how many bytes `estimate_lzw_size` missed them in
+        /// all and at most on one frame (as a fraction of it).
+        usize lzw_bytes = 0;
+        usize estimate_error = 0;
+        double max_estimate_error = 0;
+
+        /// How long `write_frame` took on each of its stages: choosing the
+        /// disposal of the pending frame, compressing and writing it, building
+        /// the palette of the new frame and mapping its pixels to it.
+        Latencies choosing;
+        Latencies compressing;
+        Latencies palettes;
+        Latencies mapping;
+        /// Size of the GIF once it has been closed.
+        usize output_bytes = 0;
+    };
+    Stats stats;
+
+    /// Palettes are never built from fewer pixels than this, as they would
+    /// miss too many colors.
+    static constexpr usize min_palette_pixels = 1 << 14;
+    /// How many pixels fit in `options.max_memory` to build a palette from.
+    usize max_palette_pixels = SIZE_MAX;
+
+    /// How many bytes the buffers of a writer take for a `width` by `height`
+    /// canvas, when palettes are built from up to `palette_pixels` pixels.
+    static auto memory_needed(usize width, usize height, usize palette_pixels,
+                              Compression compression = COMPRESS_FAST)
+        -> usize;
+
+    Writer() = default;
+    Writer(Writer &&) = default;
+    auto operator=(Writer &&) -> Writer & = default;
+    ~Writer() { close(); }
 
     /// Creates a gif file.
     ///
     /// The delay value is the time between frames in hundredths of a second -
     /// note that not all viewers pay much attention to this value.
     static auto open(std::string const &filename, usize width, usize height,
-                     usize delay, int bit_depth = 8, bool dither = false)
+                     usize delay, int bit_depth = 8, bool dither = false,
+                     WriterOptions const &options = {})
         -> std::optional<Writer>;
 
     /// Writes out a new frame to a GIF in progress.
@@ -438,11 +799,72 @@ struct Writer {
     auto write_frame(u8 const *image, usize width, usize height, usize delay,
                      int bit_depth = 8, bool dither = false) -> bool;
 
+    /// What a checkpoint saves next to the state of the writer.
+    struct Checkpoint {
+        /// Where the input continues after the frames given to the writer.
+        usize position = 0;
+        /// The settings of the encode. A checkpoint is only resumed with the
+        /// same ones, as the frames after it would not match otherwise.
+        std::string settings;
+    };
+
+    /// Saves all that is needed to continue the GIF from the next frame to
+    /// `path`, after making sure that the GIF written so far is on disk. The
+    /// file at `path` is replaced at once, so a crash leaves either the old
+    /// checkpoint or the new one.
+    auto save_checkpoint(std::string const &path,
+                         Checkpoint const &checkpoint) -> bool;
+
+    /// Reads what was saved next to the writer's state in the checkpoint at
+    /// `path`, without the state itself.
+    static auto read_checkpoint(std::string const &path)
+        -> std::optional<Checkpoint>;
+
+    /// Continues a GIF from the checkpoint at `path`, cutting off whatever was
+    /// written to it after the checkpoint was saved. `checkpoint` is filled in
+    /// with what was saved next to the writer's state.
+    static auto resume(std::string const &filename, std::string const &path,
+                       WriterOptions const &options, Checkpoint &checkpoint)
+        -> std::optional<Writer>;
+
+    /// How many bytes of the GIF have been written so far, including the ones
+    /// that are still buffered.
+    auto output_bytes() const -> usize;
+
     // Writes the EOF code, closes the file handle, and frees temp memory used
     // by a GIF. Many if not most viewers will still display a GIF properly if
     // the EOF code is missing, but it's still a good idea to write it out.
     //
     // NOTE: This is called automatically by the destructor.
     auto close() -> bool;
+
+private:
+    /// Sets up a writer for a `width` by `height` GIF written to `f`, which
+    /// it takes ownership of.
+    static auto create(FILE *f, usize width, usize height,
+                       WriterOptions const &options) -> std::optional<Writer>;
+
+    /// Picks the disposal method for the pending frame that lets `image` be
+    /// encoded in the fewest bytes.
+    ///
+    /// Pixels that are transparent in `image` but painted on the canvas can
+    /// only go back to the background by disposing of a frame over them. When
+    /// some are outside of the pending frame, its rectangle grows to cover
+    /// them.
+    auto choose_disposal(u8 const *image) -> Disposal;
+
+    /// Estimates how many bytes of image data `image` takes when encoded
+    /// within `area` after the pending frame has been disposed of with
+    /// `disposal`. The palette of `image` is not known yet, so its changed
+    /// pixels stand in for their index with the top bits of their color.
+    auto estimate_next_size(u8 const *image, Disposal disposal,
+                            Rect const &area) const -> usize;
+
+    /// Writes the pending frame to the file and applies `disposal` to the
+    /// canvas, so that it matches what a viewer would show.
+    void flush_pending(Disposal disposal);
+
+    /// Part of the canvas that can have changed since the last frame.
+    auto active_area() const -> Rect;
 };
 } // namespace uppr::gif
@@ -0,0 +1,298 @@
+#include "input.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+
+namespace uppr::gif {
+
+// === input files ===
+
+auto list_directory(std::string const &directory, std::string const &pattern)
+    -> std::optional<std::vector<std::string>> {
+    auto const dir = std::unique_ptr<DIR, int (*)(DIR *)>{
+        opendir(directory.c_str()), closedir};
+    if (!dir) return std::nullopt;
+
+    auto const prefix =
+        directory.ends_with('/') ? directory : directory + '/';
+
+    // readdir hands out whole blocks of entries at a time, and most
+    // filesystems say what each entry is without needing a stat
+    std::vector<std::string> paths;
+    while (auto const *entry = readdir(dir.get())) {
+        if (entry->d_name[0] == '.') continue;
+        if (!pattern.empty() && fnmatch(pattern.c_str(), entry->d_name, 0) != 0)
+            continue;
+
+        auto regular = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st {};
+            regular = fstatat(dirfd(dir.get()), entry->d_name, &st, 0) == 0 &&
+                      S_ISREG(st.st_mode);
+        }
+        if (!regular) continue;
+
+        auto &path = paths.emplace_back();
+        path.reserve(prefix.size() + strlen(entry->d_name));
+        path.append(prefix).append(entry->d_name);
+    }
+
+    return paths;
+}
+
+void append_natural_sort_key(std::string_view name, std::string &key) {
+    auto const digit = [](char c) { return c >= '0' && c <= '9'; };
+    for (usize i{}; i < name.size();) {
+        if (!digit(name[i])) {
+            key += name[i++];
+            continue;
+        }
+
+        // A number becomes a '0' (so that it sorts among the other characters
+        // like a digit would), its length without leading zeros and those
+        // digits. Longer numbers are bigger, and ones of the same length
+        // compare digit by digit.
+        auto start = i;
+        while (i < name.size() && digit(name[i]))
+            ++i;
+        while (start < i && name[start] == '0')
+            ++start;
+
+        key += '0';
+        key += static_cast<char>(min(i - start, usize{255}));
+        key.append(name.substr(start, i - start));
+    }
+}
+
+auto sorted_order(std::vector<std::string_view> const &names, bool natural)
+    -> std::vector<usize> {
+    // the natural keys of all names back to back, instead of one allocation
+    // for each
+    std::string natural_keys;
+    std::vector<std::string_view> keys;
+    keys.reserve(names.size());
+    if (natural) {
+        // numbers grow by at most two bytes
+        usize size{};
+        for (auto const name : names) {
+            size += name.size() + 4;
+        }
+        natural_keys.reserve(size);
+
+        std::vector<usize> ends;
+        ends.reserve(names.size());
+        for (auto const name : names) {
+            append_natural_sort_key(name, natural_keys);
+            ends.push_back(natural_keys.size());
+        }
+
+        usize start{};
+        for (auto const end : ends) {
+            keys.push_back(std::string_view{natural_keys}.substr(
+                start, end - start));
+            start = end;
+        }
+    } else {
+        keys = names;
+    }
+
+    // Names of frames tend to only differ after a long common prefix (the
+    // directory and something like `frame-`). The 8 bytes after it are
+    // enough to sort most of them, and those can be radix sorted without
+    // following a pointer to the name.
+    auto common = keys.empty() ? usize{} : keys.front().size();
+    for (auto const key : keys) {
+        common = min(common, key.size());
+        common = static_cast<usize>(
+            std::ranges::mismatch(keys.front().substr(0, common), key).in1 -
+            keys.front().begin());
+    }
+
+    struct Entry {
+        u64 head;
+        usize index;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(keys.size());
+    for (usize i{}; i < keys.size(); ++i) {
+        u64 head{};
+        auto const rest = keys[i].substr(common, 8);
+        for (usize b{}; b < 8; ++b) {
+            head = head << 8 |
+                   (b < rest.size() ? static_cast<u8>(rest[b]) : u64{});
+        }
+        entries.push_back({head, i});
+    }
+
+    // one stable pass per byte of the heads, from the last one, skipping the
+    // bytes that are the same in all of them
+    std::vector<Entry> scratch(entries.size());
+    for (usize shift{}; shift < 64; shift += 8) {
+        array<usize, 257> starts{};
+        for (auto const &entry : entries) {
+            ++starts[(entry.head >> shift & 0xff) + 1];
+        }
+        if (std::ranges::find(starts, entries.size()) != starts.end())
+            continue;
+
+        for (usize b{1}; b < starts.size(); ++b) {
+            starts[b] += starts[b - 1];
+        }
+        for (auto const &entry : entries) {
+            scratch[starts[entry.head >> shift & 0xff]++] = entry;
+        }
+        entries.swap(scratch);
+    }
+
+    // the few with the same head are sorted by the rest of their keys
+    for (auto first = entries.begin(); first != entries.end();) {
+        auto const last =
+            std::find_if(first, entries.end(), [&](auto const &entry) {
+                return entry.head != first->head;
+            });
+        if (last - first > 1) {
+            std::stable_sort(first, last, [&](auto const &a, auto const &b) {
+                return keys[a.index].substr(common) <
+                       keys[b.index].substr(common);
+            });
+        }
+        first = last;
+    }
+
+    std::vector<usize> order;
+    order.reserve(entries.size());
+    for (auto const &entry : entries) {
+        order.push_back(entry.index);
+    }
+
+    return order;
+}
+
+// === frame selection ===
+
+/// Parses a number that takes all of `text`.
+auto parse_index(std::string_view text) -> std::optional<usize> {
+    usize value;
+    auto const [ptr, ec] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc{} || ptr != text.data() + text.size())
+        return std::nullopt;
+
+    return value;
+}
+
+auto parse_frame_range(std::string const &text) -> std::optional<FrameRange> {
+    if (std::ranges::count(text, ':') > 2) return std::nullopt;
+
+    std::string_view rest = text;
+    array<std::optional<std::string_view>, 3> parts;
+    for (auto &part : parts) {
+        auto const colon = rest.find(':');
+        part = rest.substr(0, colon);
+        if (colon == std::string_view::npos) break;
+        rest.remove_prefix(colon + 1);
+    }
+
+    FrameRange range;
+    if (!parts[0]->empty()) {
+        auto const start = parse_index(*parts[0]);
+        if (!start) return std::nullopt;
+        range.start = *start;
+    }
+
+    // just a number selects only that frame
+    if (!parts[1]) {
+        if (parts[0]->empty()) return std::nullopt;
+        range.end = range.start + 1;
+        return range;
+    }
+
+    if (!parts[1]->empty()) {
+        range.end = parse_index(*parts[1]);
+        if (!range.end) return std::nullopt;
+    }
+
+    if (parts[2] && !parts[2]->empty()) {
+        auto const step = parse_index(*parts[2]);
+        if (!step || *step == 0) return std::nullopt;
+        range.step = *step;
+    }
+
+    return range;
+}
+
+auto plan_frames(usize num_inputs, usize delay, FrameRange const &range,
+                 std::optional<double> fps, Decimation decimation)
+    -> std::vector<PlannedFrame> {
+    auto const end = min(range.end.value_or(num_inputs), num_inputs);
+
+    // stops before stepping past `end`, which a large step would do by
+    // wrapping around to the first frames
+    std::vector<usize> selected;
+    for (auto i = range.start; i < end; i += range.step) {
+        selected.push_back(i);
+        if (end - i <= range.step) break;
+    }
+
+    // every selected frame is shown until the next one would be, which is at
+    // most the longest delay a GIF has (and can't wrap)
+    auto const gap = delay != 0 && range.step > 0xffff / delay
+                         ? usize{0xffff}
+                         : delay * range.step;
+    auto const period = fps ? 100.0 / *fps : 0.0;
+
+    std::vector<PlannedFrame> plan;
+    if (selected.empty()) return plan;
+
+    // without a delay the frames have no times to pick from by, they are all
+    // kept
+    if (gap == 0 || period <= static_cast<double>(gap)) {
+        plan.reserve(selected.size());
+        for (auto const i : selected) {
+            plan.push_back({{i}, gap});
+        }
+
+        return plan;
+    }
+
+    // Going to a lower frame rate. Times are in hundredths of a second since
+    // the first selected frame, input frame `k` of `selected` is shown from
+    // `k * gap` until `(k + 1) * gap`.
+    auto const duration = static_cast<double>(selected.size() * gap);
+    auto const time_of = [&](usize k) { return static_cast<double>(k * gap); };
+
+    usize k{};
+    for (usize n{}; static_cast<double>(n) * period < duration; ++n) {
+        auto const start = static_cast<double>(n) * period;
+        auto const stop = min(start + period, duration);
+
+        // the input frame being shown at `start`
+        while (k + 1 < selected.size() && time_of(k + 1) <= start)
+            ++k;
+
+        PlannedFrame frame{{selected[k]}, 0};
+        if (decimation == DECIMATE_BLEND) {
+            // and all the others that start before `stop`
+            for (auto j = k + 1; j < selected.size() && time_of(j) < stop;
+                 ++j) {
+                frame.inputs.push_back(selected[j]);
+            }
+        }
+
+        // rounding the start and stop times instead of the period keeps the
+        // total length right
+        frame.delay = static_cast<usize>(std::llround(stop) -
+                                         std::llround(start));
+        plan.push_back(std::move(frame));
+    }
+
+    return plan;
+}
+
+} // namespace uppr::gif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "gif.hpp"
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace uppr::gif {
+
+/// Lists the files in `directory` with names matching `pattern` (a shell glob,
+/// as in `fnmatch`, empty for all of them), as paths starting with
+/// `directory`, in the order the directory has them. Hidden files and
+/// subdirectories are skipped.
+auto list_directory(std::string const &directory, std::string const &pattern)
+    -> std::optional<std::vector<std::string>>;
+
+/// Adds a key for `name` to `key` that sorts it naturally when compared as
+/// bytes: the numbers in it compare by their value, so `frame-9` comes before
+/// `frame-10` and `frame-010`.
+void append_natural_sort_key(std::string_view name, std::string &key);
+
+/// The order `names` are sorted in, as indices into it. Either naturally (see
+/// `append_natural_sort_key`) or byte by byte. Equal names keep their order.
+auto sorted_order(std::vector<std::string_view> const &names, bool natural)
+    -> std::vector<usize>;
+
+/// Sorts `items` by `name(item)`, naturally or byte by byte.
+template <typename T, typename Name>
+void sort_by_name(std::vector<T> &items, Name &&name, bool natural) {
+    std::vector<std::string_view> names;
+    names.reserve(items.size());
+    for (auto const &item : items) {
+        names.emplace_back(name(item));
+    }
+
+    std::vector<T> sorted;
+    sorted.reserve(items.size());
+    for (auto const i : sorted_order(names, natural)) {
+        sorted.push_back(std::move(items[i]));
+    }
+    items = std::move(sorted);
+}
+
+/// Selects frames from the input by their index, like a python slice
+/// (`start:end:step`).
+struct FrameRange {
+    usize start = 0;
+    /// One past the last frame, `nullopt` means all of them.
+    std::optional<usize> end;
+    usize step = 1;
+};
+
+/// Parses a frame range in the form `start:end:step`. All parts are optional,
+/// so `10:`, `:100`, `::2` and `5` (a single frame) are valid too.
+auto parse_frame_range(std::string const &text) -> std::optional<FrameRange>;
+
+/// A frame of the output and the input frames it is made of.
+struct PlannedFrame {
+    /// Indices of the input frames to use. There is more than one only when
+    /// blending, and then they are averaged together.
+    std::vector<usize> inputs;
+    /// How long the frame is shown, in hundredths of a second.
+    usize delay;
+};
+
+/// How to drop frames when going to a lower frame rate.
+enum Decimation {
+    /// Use the input frame that is shown when the output frame starts.
+    DECIMATE_CHOOSE,
+    /// Average all input frames that are shown during the output frame.
+    DECIMATE_BLEND,
+};
+
+/// Decides which of the `num_inputs` input frames are needed to make the
+/// output, and for how long each output frame is shown. Input frames are
+/// `delay` hundredths of a second apart. The range is applied first, then the
+/// frame rate is reduced to `fps` (if given). With a `delay` of 0 the frames
+/// have no times to reduce by, and all of the selected ones are kept.
+///
+/// This only looks at indices, so frames that are not used never need to be
+/// opened.
+auto plan_frames(usize num_inputs, usize delay, FrameRange const &range,
+                 std::optional<double> fps, Decimation decimation)
+    -> std::vector<PlannedFrame>;
+
+} // namespace uppr::gif
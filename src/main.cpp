@@ -1,89 +1,295 @@
 #include "CLI11.hpp"
+#include "frame_source.hpp"
 #include "gif.hpp"
-#include "stb_image.h"
+#include "input.hpp"
+#include "measure.hpp"
+#include "metrics.hpp"
+#include "soak.hpp"
+#include "tune.hpp"
+#include "verify.hpp"
 
 #include <charconv>
 #include <chrono>
 #include <cmath>
 #include <string>
+#include <thread>
+
+#include <sys/stat.h>
+
+#if defined(_MSC_VER)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
 using std::chrono::steady_clock;
+using uppr::gif::ActiveArea;
+using uppr::gif::ArchiveSource;
+using uppr::gif::FileSource;
+using uppr::gif::Frame;
+using uppr::gif::FrameRange;
+using uppr::gif::frame_pool;
+using uppr::gif::FrameSource;
+using uppr::gif::host_tuning;
+using uppr::gif::IndexedSource;
+using uppr::gif::Latencies;
+using uppr::gif::max;
+using uppr::gif::Metrics;
+using uppr::gif::MetricsExport;
+using uppr::gif::min;
+using uppr::gif::PlannedFrame;
+using uppr::gif::PlannedSource;
+using uppr::gif::plan_frames;
+using uppr::gif::PrefetchSource;
+using uppr::gif::Quality;
+using uppr::gif::QualityMeter;
+using uppr::gif::Rect;
+using uppr::gif::Search;
+using uppr::gif::SoakOptions;
+using uppr::gif::StreamSource;
+using uppr::gif::SyntheticSource;
+using uppr::gif::timed;
+using uppr::gif::TuneOptions;
+using uppr::gif::u64;
 using uppr::gif::u8;
 using uppr::gif::usize;
+using uppr::gif::VerifyOptions;
 using uppr::gif::Writer;
+using uppr::gif::WriterOptions;
 
-auto example(std::string const &filename, int delay, int bit_depth) -> int {
-    const auto width = 512UL;
-    const auto height = 512UL;
-    std::array<u8, width * height * 4> image;
-
-    auto set_pixel = [&](usize x, usize y, u8 red, u8 green, u8 blue) {
-        uint8_t *pixel = &image[(y * width + x) * 4];
-        pixel[0] = red;
-        pixel[1] = blue;
-        pixel[2] = green;
-        pixel[3] = 255; // no alpha for this demo
-    };
+/// Parses a size like `640x480`.
+auto parse_size(std::string const &text)
+    -> std::optional<std::pair<usize, usize>> {
+    auto const x = text.find('x');
+    if (x == std::string::npos) return std::nullopt;
+
+    usize width{};
+    usize height{};
+    auto const end = text.data() + text.size();
+    auto const [width_end, width_error] =
+        std::from_chars(text.data(), text.data() + x, width);
+    auto const [height_end, height_error] =
+        std::from_chars(text.data() + x + 1, end, height);
+    if (width_error != std::errc{} || width_end != text.data() + x ||
+        height_error != std::errc{} || height_end != end || width == 0 ||
+        height == 0 || width > 0xffff || height > 0xffff)
+        return std::nullopt;
+
+    return std::pair{width, height};
+}
+
+/// Replaces the directories in `input_files` with the files in them that match
+/// `glob`, and sorts the list naturally if asked to. Reading directories here
+/// instead of having the shell expand `dir/*` keeps huge ones from going over
+/// the limit on the size of the command line.
+auto expand_inputs(std::vector<std::string> const &input_files,
+                   std::string const &glob, bool numeric_sort)
+    -> std::optional<std::vector<std::string>> {
+    std::vector<std::string> files;
+    auto listed = false;
+    for (auto const &input : input_files) {
+        struct stat st {};
+        if (input == "-" || stat(input.c_str(), &st) != 0 ||
+            !S_ISDIR(st.st_mode)) {
+            files.push_back(input);
+            continue;
+        }
+
+        auto found = uppr::gif::list_directory(input, glob);
+        if (!found) {
+            fprintf(stderr, "Error reading input directory: %s\n",
+                    input.c_str());
+            return std::nullopt;
+        }
+
+        // like the shell would have listed them, unless all are sorted
+        // naturally below
+        if (!numeric_sort) {
+            uppr::gif::sort_by_name(
+                *found, [](auto const &file) -> auto const & { return file; },
+                false);
+        }
+
+        listed = true;
+        files.insert(files.end(), std::make_move_iterator(found->begin()),
+                     std::make_move_iterator(found->end()));
+    }
+
+    if (!glob.empty() && !listed) {
+        fprintf(stderr, "--glob needs a directory in --input-files\n");
+        return std::nullopt;
+    }
+
+    if (numeric_sort && !(files.size() == 1 && files.front().ends_with(".tar")))
+        uppr::gif::sort_by_name(
+            files, [](auto const &file) -> auto const & { return file; }, true);
+
+    return files;
+}
+
+/// Opens the input files as a source of frames. A single `.tar` file is read
+/// as an archive of frames.
+auto open_inputs(std::vector<std::string> const &input_files, usize delay,
+                 bool numeric_sort) -> std::unique_ptr<IndexedSource> {
+    auto const &first = input_files.front();
+    if (input_files.size() == 1 && first.ends_with(".tar")) {
+        auto archive = ArchiveSource::open(first, delay);
+        if (!archive) {
+            fprintf(stderr, "Error opening input file: %s\n", first.c_str());
+            return nullptr;
+        }
+
+        if (numeric_sort) {
+            uppr::gif::sort_by_name(
+                archive->members,
+                [](auto const &member) -> auto const & { return member.name; },
+                true);
+        }
+        return archive;
+    }
 
-    auto set_pixel_float = [&](usize xx, usize yy, float fred, float fgrn,
-                               float fblu) {
-        // convert float to unorm
-        auto const red = static_cast<u8>(roundf(255.0F * fred));
-        auto const grn = static_cast<u8>(roundf(255.0F * fgrn));
-        auto const blu = static_cast<u8>(roundf(255.0F * fblu));
+    // already sorted by `expand_inputs`
+    return std::make_unique<FileSource>(input_files, delay);
+}
 
-        set_pixel(xx, yy, red, grn, blu);
+/// Describes everything that changes the GIF made from `input_files`, for
+/// checkpoints to only be resumed by the same encode.
+auto encode_settings(CLI::App const &app,
+                     std::vector<std::string> const &input_files)
+    -> std::string {
+    // options that only change how fast the GIF is made, or where it goes
+    static constexpr std::string_view ignored[] = {
+        "--input-files",      "--output-file", "--checkpoint-every",
+        "--checkpoint",       "--resume",      "--measure",
+        "--measure-csv",      "--metrics",     "--metrics-format",
+        "--metrics-interval", "--progress",    "--threads",
+        "--help",
     };
 
-    auto start = steady_clock::now();
+    std::string settings;
+    for (auto const *option : app.get_options()) {
+        auto const name = option->get_name();
+        if (std::ranges::find(ignored, name) != std::end(ignored)) continue;
 
-    // Create a gif
-    auto writer_ = Writer::open(filename, width, height, delay, bit_depth, true);
-    if (!writer_) {
-        fprintf(stderr, "Error opening output file: %s\n", filename.c_str());
-        return 1;
+        // without a memory limit, prefetching doesn't change the output
+        if ((name == "--decode-threads" || name == "--prefetch") &&
+            app.get_option("--max-memory")->as<usize>() == 0)
+            continue;
+
+        // of the searches, only the approximate one changes the output
+        if (name == "--search" && option->as<std::string>() != "approx")
+            continue;
+
+        settings += name + "=" + option->as<std::string>() + "\n";
     }
 
-    auto writer = std::move(*writer_);
+    // the inputs only by their names, hashed (FNV-1a) to keep it short
+    u64 hash = 0xcbf29ce484222325;
+    for (auto const &file : input_files) {
+        // with the terminating zero, so that names can't run into each other
+        for (auto const c : std::string_view{file.c_str(), file.size() + 1}) {
+            hash = (hash ^ static_cast<u8>(c)) * 0x100000001b3;
+        }
+    }
+    settings += "inputs=" + std::to_string(input_files.size()) + ":" +
+                std::to_string(hash) + "\n";
 
-    auto const total_frames = 256;
-    for (usize frame{}; frame < total_frames; ++frame) {
-        // Make an image, somehow
-        // this is the default shadertoy - credit to shadertoy.com
-        auto const tt = static_cast<float>(frame) * 3.14159F * 2 / 255.0F;
-        for (usize y{}; y < height; ++y) {
-            for (usize x{}; x < width; ++x) {
-                float fx = static_cast<float>(x) / width;
-                float fy = static_cast<float>(y) / height;
-
-                float red = 0.5F + 0.5F * cosf(tt + fx);
-                float grn = 0.5F + 0.5F * cosf(tt + fy + 2.F);
-                float blu = 0.5F + 0.5F * cosf(tt + fx + 4.F);
-
-                set_pixel_float(x, y, red, grn, blu);
-            }
+    // the only setting of the tuning profile that changes the output
+    if (app.get_option("--palette-pixels")->as<usize>() == 0) {
+        settings += "tuned-palette-pixels=" +
+                    std::to_string(host_tuning().palette_pixels) + "\n";
+    }
+
+    return settings;
+}
+
+/// Decodes all frames after `first` to find the part of them that ever changes.
+auto find_active_area(FrameSource &source, Frame first, u8 alpha_threshold)
+    -> std::optional<Rect> {
+    ActiveArea active{first.pixels.get(), first.width, first.height,
+                      alpha_threshold};
+    first.pixels.release();
+
+    for (usize i{1};; ++i) {
+        auto const frame = source.next();
+        if (!frame) break;
+        if (frame->width != active.width || frame->height != active.height) {
+            fprintf(stderr, "Input frame %zu has a different size\n", i);
+            return std::nullopt;
         }
 
-        // Write the frame to the gif
-        auto const p =
-            static_cast<double>(frame) / static_cast<double>(total_frames);
-        printf("Writing frame %zu/%d... (%.02f%%)\r", frame, total_frames,
-               p * 100);
+        printf("Analyzing frame %zu...\r", i);
         fflush(stdout);
-        writer.write_frame(image.data(), width, height, delay, bit_depth, true);
+        active.add_frame(frame->pixels.get());
     }
+    printf("\n");
+    if (source.failed) return std::nullopt;
 
-    auto end = steady_clock::now();
-    auto delta = duration_cast<milliseconds>(end - start).count();
-    printf("\ndone %lds (%.02fms/frame)\n", delta / 1000,
-           static_cast<double>(delta) / static_cast<double>(total_frames));
+    // nothing ever changes, then the whole first frame is what matters
+    if (active.area.empty()) return Rect{0, 0, active.width, active.height};
+    return active.area;
+}
 
-    // Write EOF (called on destructor)
-    // writer.close();
+/// Prints how close the output frames are to their sources, and writes the
+/// quality of each frame to `csv_file` as CSV if it is not empty.
+auto report_quality(std::map<usize, Quality> const &results,
+                    std::string const &csv_file) -> bool {
+    if (results.empty()) return true;
 
-    return 0;
+    auto csv = std::unique_ptr<FILE, int (*)(FILE *)>{nullptr, fclose};
+    if (!csv_file.empty()) {
+        csv = {fopen(csv_file.c_str(), "w"), fclose};
+        if (!csv) {
+            fprintf(stderr, "Error opening %s\n", csv_file.c_str());
+            return false;
+        }
+        fprintf(csv.get(), "frame,mse,psnr,ssim\n");
+    }
+
+    double mse_sum{};
+    double ssim_sum{};
+    auto worst_psnr = results.begin();
+    auto worst_ssim = results.begin();
+    for (auto it = results.begin(); it != results.end(); ++it) {
+        auto const &[frame, quality] = *it;
+        mse_sum += quality.mse;
+        ssim_sum += quality.ssim;
+        if (quality.psnr < worst_psnr->second.psnr) worst_psnr = it;
+        if (quality.ssim < worst_ssim->second.ssim) worst_ssim = it;
+
+        if (csv) {
+            fprintf(csv.get(), "%zu,%.4f,%.4f,%.6f\n", frame, quality.mse,
+                    quality.psnr, quality.ssim);
+        }
+    }
+
+    // PSNR of the mean error, so that identical frames (with an infinite
+    // PSNR) don't make the average meaningless
+    auto const n = static_cast<double>(results.size());
+    auto const mse = mse_sum / n;
+    if (mse == 0) {
+        printf("quality of %zu frames: lossless\n", results.size());
+        return true;
+    }
+
+    auto const psnr = 10 * std::log10(255.0 * 255.0 / mse);
+    printf("quality of %zu frames: PSNR %.2fdB (worst %.2fdB at frame %zu), "
+           "SSIM %.4f (worst %.4f at frame %zu)\n",
+           results.size(), psnr, worst_psnr->second.psnr, worst_psnr->first,
+           ssim_sum / n, worst_ssim->second.ssim, worst_ssim->first);
+
+    return true;
+}
+
+/// Copies the pixels inside of `rect` of an image `width` pixels wide into
+/// `out`, packed.
+void crop_image(u8 const *image, usize width, Rect const &rect, u8 *out) {
+    for (usize y{}; y < rect.height; ++y) {
+        auto const row = image + ((rect.top + y) * width + rect.left) * 4;
+        std::copy(row, row + rect.width * 4, out + y * rect.width * 4);
+    }
 }
 
 auto main(int argc, const char *argv[]) -> int {
@@ -91,7 +297,13 @@ auto main(int argc, const char *argv[]) -> int {
 
     std::vector<std::string> input_files;
     app.add_option("-i,--input-files", input_files,
-                   "Name of the file to use as input in the conversion");
+                   "Name of the file to use as input in the conversion, or a "
+                   "directory to use the files in");
+
+    std::string glob;
+    app.add_option("--glob", glob,
+                   "Only use the files in input directories with names "
+                   "matching this pattern (like 'frame-*.png')");
 
     std::string output_file;
     app.add_option("-o,--output-file", output_file,
@@ -116,91 +328,728 @@ auto main(int argc, const char *argv[]) -> int {
     app.add_flag("--gen-example", gen_example, "Generate an example GIF file")
         ->default_val(false);
 
+    std::string example_content;
+    std::vector<std::string> content_names;
+    for (auto const &[content, name] : uppr::gif::synthetic_contents) {
+        content_names.emplace_back(name);
+    }
+    app.add_option("--example-content", example_content,
+                   "What the frames of --gen-example show")
+        ->check(CLI::IsMember(content_names))
+        ->default_val("gradient");
+
+    std::string example_size;
+    app.add_option("--example-size", example_size,
+                   "Size of the frames of --gen-example, as WIDTHxHEIGHT")
+        ->default_val("512x512");
+
+    usize example_frames;
+    app.add_option("--example-frames", example_frames,
+                   "How many frames --gen-example makes")
+        ->default_val(256)
+        ->check(CLI::PositiveNumber);
+
     bool numeric_sort = false;
-    app.add_flag(
-           "--numeric-sort", numeric_sort,
-           "Try to find a number in all filenames and sort the list by it")
+    app.add_flag("--numeric-sort", numeric_sort,
+                 "Sort the inputs by name, comparing the numbers in them by "
+                 "value (frame-9 before frame-10)")
+        ->default_val(false);
+
+    bool auto_trim = false;
+    app.add_flag("--auto-trim", auto_trim,
+                 "Find the borders that never change and only look inside of "
+                 "them after the first frame")
+        ->default_val(false);
+
+    bool auto_crop = false;
+    app.add_flag("--auto-crop", auto_crop,
+                 "Find the borders that never change and crop them out")
+        ->default_val(false);
+
+    bool interlace = false;
+    app.add_flag("--interlace", interlace,
+                 "Write interlaced frames, so viewers can show them early")
         ->default_val(false);
 
+    usize alpha_threshold;
+    app.add_option("--alpha-threshold", alpha_threshold,
+                   "Input pixels with less alpha than this are transparent "
+                   "(like 128 for stickers), 0 ignores alpha")
+        ->default_val(0)
+        ->check(CLI::Range(0, 255));
+
+    std::string compress;
+    app.add_option("--compress", compress,
+                   "LZW compression: fast, or max to look ahead for "
+                   "slightly smaller frames")
+        ->check(CLI::IsMember({"fast", "max"}))
+        ->default_val("fast");
+
+    int delta_palettes;
+    app.add_option("--delta-palettes", delta_palettes,
+                   "Keep the palette of the previous frame when, after "
+                   "replacing the colors no new pixel uses, all of the new "
+                   "pixels are within this error (over RGB, like 12) of one "
+                   "of its colors. 0 builds a new palette for each frame")
+        ->default_val(0)
+        ->check(CLI::Range(0, 765));
+
+    std::string frames;
+    app.add_option("--frames", frames,
+                   "Only use the input frames in start:end:step (all parts "
+                   "optional, end is not included)");
+
+    std::optional<double> fps;
+    app.add_option("--fps", fps,
+                   "Drop input frames to get to this frame rate, assuming "
+                   "the inputs are --delay apart")
+        ->check(CLI::PositiveNumber);
+
+    bool blend = false;
+    app.add_flag("--blend", blend,
+                 "Average the dropped frames instead of picking one when "
+                 "using --fps")
+        ->default_val(false);
+
+    usize decode_threads;
+    app.add_option("--decode-threads", decode_threads,
+                   "Threads decoding input frames ahead of the encoder, 0 "
+                   "for one per core")
+        ->default_val(0);
+
+    usize prefetch;
+    app.add_option("--prefetch", prefetch,
+                   "How many decoded frames can wait for the encoder")
+        ->default_val(8)
+        ->check(CLI::PositiveNumber);
+
+    usize max_memory;
+    app.add_option("--max-memory", max_memory,
+                   "Most memory to use for frames and encoding (like 512M or "
+                   "2G), 0 for no limit. Fewer frames are prefetched and "
+                   "palettes are built from samples to stay within it")
+        ->default_val(0)
+        ->transform(CLI::AsSizeValue(false));
+
+    usize checkpoint_every;
+    app.add_option("--checkpoint-every", checkpoint_every,
+                   "Save a checkpoint every this many frames, to continue "
+                   "with --resume if the encode is interrupted (0 to never)")
+        ->default_val(0);
+
+    std::string checkpoint_file;
+    app.add_option("--checkpoint", checkpoint_file,
+                   "Where to save checkpoints (the output file name with "
+                   ".checkpoint added by default)");
+
+    bool resume = false;
+    app.add_flag("--resume", resume,
+                 "Continue an interrupted encode from its last checkpoint, "
+                 "with the same options")
+        ->default_val(false);
+
+    bool measure = false;
+    app.add_flag("--measure", measure,
+                 "Measure the PSNR and SSIM of each frame against its source, "
+                 "on a background thread, and how close the size estimates "
+                 "were")
+        ->default_val(false);
+
+    std::string measure_csv;
+    app.add_option("--measure-csv", measure_csv,
+                   "Also write the quality of each frame to this CSV file");
+
+    std::string metrics_file;
+    app.add_option("--metrics", metrics_file,
+                   "Write the progress of the encode, how long its stages "
+                   "take, its memory and its queues to this file every "
+                   "--metrics-interval seconds (like /dev/fd/3)");
+
+    std::string metrics_format;
+    app.add_option("--metrics-format", metrics_format,
+                   "How to write --metrics: json to add a line for each "
+                   "report, or prometheus to replace a textfile")
+        ->check(CLI::IsMember({"json", "prometheus"}))
+        ->default_val("json");
+
+    double metrics_interval;
+    app.add_option("--metrics-interval", metrics_interval,
+                   "Seconds between --metrics reports")
+        ->default_val(1.0)
+        ->check(CLI::PositiveNumber);
+
+    bool progress = false;
+    app.add_flag("--progress", progress,
+                 "Show the frame being written even when the output is not a "
+                 "terminal")
+        ->default_val(false);
+
+    usize threads;
+    app.add_option("--threads", threads,
+                   "Threads mapping pixels to the palette when not "
+                   "dithering, 0 to use the tuning profile")
+        ->default_val(0);
+
+    std::string search;
+    app.add_option("--search", search,
+                   "How to find palette colors: tree, cache (faster for "
+                   "repeating colors), approx (faster, but not always the "
+                   "closest color), or auto to use the tuning profile")
+        ->check(CLI::IsMember({"auto", "tree", "cache", "approx"}))
+        ->default_val("auto");
+
+    usize palette_pixels;
+    app.add_option("--palette-pixels", palette_pixels,
+                   "Build the palettes of frames with more pixels than this "
+                   "from samples of them, 0 to use the tuning profile")
+        ->default_val(0);
+
+    auto *tune_command = app.add_subcommand(
+        "tune", "Benchmark the encoder on synthetic frames and save the "
+                "fastest settings as the tuning profile of this machine");
+
+    TuneOptions tune_options;
+    tune_command->add_option("--width", tune_options.width,
+                             "Width of the frames")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 0xffff));
+    tune_command->add_option("--height", tune_options.height,
+                             "Height of the frames")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 0xffff));
+    tune_command->add_option("--max-threads", tune_options.max_threads,
+                             "Most threads to try, 0 for one per core")
+        ->capture_default_str();
+
+    std::string profile_file = uppr::gif::tuning_path();
+    tune_command->add_option("--profile", profile_file,
+                             "Where to save the profile")
+        ->capture_default_str();
+
+    auto *verify_command = app.add_subcommand(
+        "verify", "Check that the GIFs made from synthetic frames don't depend "
+                  "on how many threads made them");
+
+    VerifyOptions verify_options;
+    verify_command->add_option("--width", verify_options.width,
+                               "Width of the frames")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 0xffff));
+    verify_command->add_option("--height", verify_options.height,
+                               "Height of the frames")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 0xffff));
+    verify_command->add_option("--frames", verify_options.frames,
+                               "Frames of each kind to encode")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    verify_command->add_option("--max-threads", verify_options.max_threads,
+                               "Most threads to use, 0 for twice one per core")
+        ->capture_default_str();
+
+    auto *soak_command = app.add_subcommand(
+        "soak", "Encode synthetic frames for a long time, and check that the "
+                "throughput and memory use stay stable");
+
+    SoakOptions soak_options;
+    soak_command->add_option("--width", soak_options.width,
+                             "Width of the frames")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 0xffff));
+    soak_command->add_option("--height", soak_options.height,
+                             "Height of the frames")
+        ->capture_default_str()
+        ->check(CLI::Range(1, 0xffff));
+    std::string soak_content;
+    soak_command->add_option("--content", soak_content,
+                             "What the frames show")
+        ->check(CLI::IsMember(content_names))
+        ->default_val("ui");
+    soak_command->add_flag("--dither", soak_options.dither,
+                           "Dither the frames");
+    soak_command->add_option("--seconds", soak_options.seconds,
+                             "How long to encode for")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    soak_command->add_option("--interval", soak_options.interval,
+                             "Seconds between samples, the first one is "
+                             "taken as the warm-up. At least 5 are needed")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    soak_command->add_option("--max-drift", soak_options.max_drift,
+                             "Fail when the frames per second of the second "
+                             "half of the samples are this much lower than "
+                             "the first half, as a fraction")
+        ->capture_default_str()
+        ->check(CLI::NonNegativeNumber);
+    soak_command->add_option("--max-growth", soak_options.max_growth,
+                             "Fail when the resident memory grows by more "
+                             "than this (like 16M) after the warm-up")
+        ->transform(CLI::AsSizeValue(false))
+        ->default_val("16M");
+    soak_command->add_option("--max-allocations",
+                             soak_options.max_allocations,
+                             "Fail when the buffer pool allocates more blocks "
+                             "than this after the warm-up")
+        ->capture_default_str();
+
     CLI11_PARSE(app, argc, argv);
+    if (!measure_csv.empty()) measure = true;
+
+    if (*tune_command) {
+        auto const tuning = uppr::gif::tune(tune_options);
+        if (profile_file.empty()) {
+            fprintf(stderr, "No home directory to save the profile in, use "
+                            "--profile\n");
+            return 1;
+        }
+        if (!uppr::gif::write_tuning(profile_file, tuning)) return 1;
+
+        printf("Saved to %s\n", profile_file.c_str());
+        return 0;
+    }
+
+    if (*verify_command)
+        return uppr::gif::verify_determinism(verify_options) ? 0 : 1;
+
+    if (*soak_command) {
+        soak_options.content =
+            std::ranges::find_if(uppr::gif::synthetic_contents,
+                                 [&](auto const &c) {
+                                     return c.second == soak_content;
+                                 })
+                ->first;
+        return uppr::gif::soak(soak_options) ? 0 : 1;
+    }
 
-    if (gen_example) return example(output_file, delay, bit_depth);
+    if (checkpoint_file.empty()) checkpoint_file = output_file + ".checkpoint";
 
-    if (input_files.empty()) {
+    if (decode_threads == 0)
+        decode_threads = max(std::thread::hardware_concurrency(), 1U);
+
+    if (!gen_example && input_files.empty()) {
         fprintf(stderr, "--input-files requires at least one argument\n");
         return 1;
     }
 
-    if (numeric_sort) {
-        std::sort(input_files.begin(), input_files.end(),
-                  [&](std::string const &a, std::string const &b) {
-                      static constexpr auto const nums = "0123456789";
-                      auto na = a.substr(a.find_first_of(nums));
-                      na = na.substr(0, na.find_first_not_of(nums));
-
-                      auto nb = b.substr(b.find_first_of(nums));
-                      nb = nb.substr(0, nb.find_first_not_of(nums));
+    if (!gen_example) {
+        auto expanded = expand_inputs(input_files, glob, numeric_sort);
+        if (!expanded) return 1;
+        if (expanded->empty()) {
+            fprintf(stderr, "No input files found in the input directories\n");
+            return 1;
+        }
+        input_files = std::move(*expanded);
+    }
 
-                      usize aa;
-                      usize bb;
+    // `-i -` reads a stream of PNM images from stdin, which can only be read
+    // once and from the start
+    auto const from_stdin = !gen_example && input_files.size() == 1 &&
+                            input_files.front() == "-";
+    if (from_stdin && (!frames.empty() || fps || auto_trim || auto_crop)) {
+        fprintf(stderr, "--frames, --fps, --auto-trim and --auto-crop can't "
+                        "be used when reading from stdin\n");
+        return 1;
+    }
+    if (fps && delay <= 0) {
+        fprintf(stderr, "--fps needs a --delay above 0, it is how far apart "
+                        "the input frames are\n");
+        return 1;
+    }
 
-                      std::from_chars(na.data(), na.data() + na.size(), aa);
-                      std::from_chars(nb.data(), nb.data() + nb.size(), bb);
+    std::optional<FrameRange> range = FrameRange{};
+    if (!frames.empty()) {
+        range = uppr::gif::parse_frame_range(frames);
+        if (!range) {
+            fprintf(stderr, "Invalid frame range: %s\n", frames.c_str());
+            return 1;
+        }
+    }
 
-                      return bb > aa;
-                  });
+    auto const example = parse_size(example_size);
+    if (gen_example && !example) {
+        fprintf(stderr, "Invalid example size: %s\n", example_size.c_str());
+        return 1;
     }
 
+    // only checkpoints need them, and hashing the names of millions of inputs
+    // takes a while
+    auto const settings = checkpoint_every != 0 || resume
+                              ? encode_settings(app, input_files)
+                              : std::string{};
+
+    // the first frame is used to pick the prefetch depth within --max-memory,
+    // so no more are decoded before it is known
+    auto const first_depth = max_memory != 0 ? 1 : prefetch;
+
+    // sources of the frames to write, picked by the plan. Each call starts
+    // from frame `start` of the plan.
+    std::vector<PlannedFrame> plan;
+    auto open_source = [&](usize start) -> std::unique_ptr<PrefetchSource> {
+        std::unique_ptr<IndexedSource> inputs;
+        if (gen_example) {
+            auto const content = std::ranges::find_if(
+                uppr::gif::synthetic_contents,
+                [&](auto const &c) { return c.second == example_content; });
+            inputs = std::make_unique<SyntheticSource>(
+                example->first, example->second, example_frames, delay,
+                content->first);
+        } else if (from_stdin) {
+            // a stream can't seek, the frames before `start` are read and
+            // thrown away
+            auto stream = std::make_unique<StreamSource>(stdin, delay);
+            for (usize i{}; i < start; ++i) {
+                if (!stream->next()) {
+                    fprintf(stderr, "The input stream ended before the "
+                                    "checkpoint\n");
+                    return nullptr;
+                }
+            }
+
+            return std::make_unique<PrefetchSource>(std::move(stream), 1,
+                                                    first_depth);
+        } else {
+            inputs = open_inputs(input_files, delay, numeric_sort);
+            if (!inputs) return nullptr;
+        }
+
+        if (plan.empty()) {
+            plan = plan_frames(inputs->count(), delay, *range, fps,
+                               blend ? uppr::gif::DECIMATE_BLEND
+                                     : uppr::gif::DECIMATE_CHOOSE);
+            if (plan.empty()) {
+                fprintf(stderr, "No input frames selected\n");
+                return nullptr;
+            }
+        }
+
+        auto planned =
+            std::make_unique<PlannedSource>(std::move(inputs), plan);
+        planned->cursor = min(start, plan.size());
+
+        return std::make_unique<PrefetchSource>(std::move(planned),
+                                                decode_threads, first_depth);
+    };
+
+    // how many bytes a source takes when prefetching `depth` frames: the frame
+    // in use, the ones waiting, and the file contents and decoder scratch space
+    // of the ones being decoded
+    auto source_memory = [&](usize frame_bytes, usize depth) {
+        return frame_bytes * (1 + depth + 2 * min(decode_threads, depth));
+    };
+
+    // the deepest prefetch that leaves `reserved` bytes of --max-memory for
+    // everything else
+    auto fit_prefetch = [&](usize frame_bytes,
+                            usize reserved) -> std::optional<usize> {
+        for (auto depth = prefetch; depth > 0; --depth) {
+            if (source_memory(frame_bytes, depth) + reserved <= max_memory)
+                return depth;
+        }
+        return std::nullopt;
+    };
+
+    auto too_little_memory = [&](usize needed) {
+        fprintf(stderr,
+                "--max-memory is too low for these frames, they need at "
+                "least %zu bytes\n",
+                needed);
+    };
+
     auto start = steady_clock::now();
 
-    auto it = input_files.begin();
-    int w;
-    int h;
-    int n;
-    auto data = std::unique_ptr<stbi_uc[], void (*)(stbi_uc *)>{
-        stbi_load(it->c_str(), &w, &h, &n, 4),
-        [](stbi_uc *a) { stbi_image_free(a); }};
-    if (!data) {
-        fprintf(stderr, "Error opening first input file: %s\n", it->c_str());
+    std::optional<Rect> active;
+    if (auto_trim || auto_crop) {
+        auto const source = open_source(0);
+        if (!source) return 1;
+
+        auto first = source->next();
+        if (!first) return 1;
+
+        if (max_memory != 0) {
+            // next to the frames, only `ActiveArea` keeps a copy of one
+            auto const frame_bytes = first->width * first->height * 4;
+            auto const depth = fit_prefetch(frame_bytes, frame_bytes);
+            if (!depth) {
+                too_little_memory(source_memory(frame_bytes, 1) + frame_bytes);
+                return 1;
+            }
+            source->set_depth(*depth);
+        }
+
+        active = find_active_area(*source, std::move(*first),
+                                  static_cast<u8>(alpha_threshold));
+        if (!active) return 1;
+
+        printf("Active area: %zux%zu at %zu,%zu\n", active->width,
+               active->height, active->left, active->top);
+    }
+
+    // where the last checkpoint left off, if continuing from one
+    Writer::Checkpoint checkpoint;
+    if (resume) {
+        auto const saved = Writer::read_checkpoint(checkpoint_file);
+        if (!saved) return 1;
+
+        checkpoint = *saved;
+        if (checkpoint.settings != settings) {
+            fprintf(stderr, "%s was saved with other settings or inputs\n",
+                    checkpoint_file.c_str());
+            return 1;
+        }
+    }
+
+    WriterOptions options;
+    if (auto_trim && !auto_crop) options.active_area = *active;
+    options.interlace = interlace;
+    options.alpha_threshold = static_cast<u8>(alpha_threshold);
+    options.compression = compress == "max" ? uppr::gif::COMPRESS_MAX
+                                            : uppr::gif::COMPRESS_FAST;
+    options.delta_palette_error = delta_palettes;
+    options.check_estimates = measure;
+    options.threads = threads;
+    options.search = search == "tree"     ? Search::tree
+                     : search == "cache"  ? Search::cache
+                     : search == "approx" ? Search::approx
+                                          : Search::automatic;
+    options.palette_pixels = palette_pixels;
+
+    auto const source = open_source(checkpoint.position);
+    if (!source) return 1;
+
+    auto first = source->next();
+    if (!first && resume && !source->failed) {
+        // all frames had been given to the writer, only the last one is left
+        // to write
+        auto writer = Writer::resume(output_file, checkpoint_file, options,
+                                     checkpoint);
+        if (!writer || !writer->close()) return 1;
+
+        std::remove(checkpoint_file.c_str());
+        printf("done, nothing was left to encode after the checkpoint\n");
+        return 0;
+    }
+    if (!first) {
+        if (!source->failed) fprintf(stderr, "No input frames\n");
         return 1;
     }
+    auto const width = first->width;
+    auto const height = first->height;
+
+    // when cropping, the whole output is the active area
+    auto const crop = auto_crop ? *active : Rect{0, 0, width, height};
+    auto const cropped =
+        frame_pool().acquire(auto_crop ? crop.area() * 4 : 0);
+    auto frame_data = [&](Frame const &frame) -> u8 const * {
+        if (!auto_crop) return frame.pixels.get();
+
+        crop_image(frame.pixels.get(), width, crop, cropped.get());
+        return cropped.get();
+    };
+
+    if (max_memory != 0) {
+        // prefer building palettes from whole frames over prefetching more of
+        // them, but sample them rather than not prefetching at all
+        auto const frame_bytes = width * height * 4;
+        auto const full = Writer::memory_needed(crop.width, crop.height,
+                                                crop.area(),
+                                                options.compression) +
+                          cropped.capacity;
+        auto const least =
+            Writer::memory_needed(crop.width, crop.height,
+                                  Writer::min_palette_pixels,
+                                  options.compression) +
+            cropped.capacity;
+
+        auto depth = fit_prefetch(frame_bytes, full);
+        if (!depth) depth = fit_prefetch(frame_bytes, least);
+        if (!depth) {
+            too_little_memory(source_memory(frame_bytes, 1) + least);
+            return 1;
+        }
+
+        source->set_depth(*depth);
+        options.max_memory = max_memory - source_memory(frame_bytes, *depth) -
+                             cropped.capacity;
+    }
+
+    auto const dithering = !dither;
 
-    // Create a gif
-    auto writer_ =
-        Writer::open(output_file, w, h, delay, bit_depth, !dither);
+    // Create a gif, or continue the one of the checkpoint
+    auto writer_ = resume ? Writer::resume(output_file, checkpoint_file,
+                                           options, checkpoint)
+                          : Writer::open(output_file, crop.width, crop.height,
+                                         delay, bit_depth, dithering, options);
     if (!writer_) {
-        fprintf(stderr, "Error opening output file: %s\n", output_file.c_str());
+        if (!resume)
+            fprintf(stderr, "Error opening output file: %s\n",
+                    output_file.c_str());
         return 1;
     }
 
     auto writer = std::move(*writer_);
-    auto frame = 0;
-    auto const total_frames = input_files.size();
-    writer.write_frame(data.get(), w, h, delay, bit_depth, !dither);
+    if (writer.width != crop.width || writer.height != crop.height) {
+        fprintf(stderr, "The input frames don't match the checkpoint\n");
+        return 1;
+    }
+
+    // how long the encoder waited for decoded frames, and took to queue frames
+    // to be measured and to save checkpoints
+    Latencies waiting;
+    Latencies measuring;
+    Latencies checkpointing;
+
+    // saves a checkpoint every --checkpoint-every frames, `position` being
+    // the next frame of the plan
+    auto maybe_checkpoint = [&](usize position) {
+        if (checkpoint_every == 0 || position % checkpoint_every != 0) return;
+
+        checkpoint.position = position;
+        checkpoint.settings = settings;
+        if (!timed(checkpointing, [&] {
+                return writer.save_checkpoint(checkpoint_file, checkpoint);
+            }))
+            fprintf(stderr, "\nError saving checkpoint: %s\n",
+                    checkpoint_file.c_str());
+    };
+
+    // after a frame is written, `old_image` is what a viewer shows for it
+    auto const meter = measure ? std::make_unique<QualityMeter>(crop.width,
+                                                                crop.height)
+                               : nullptr;
+    auto maybe_measure = [&](usize position, u8 const *image) {
+        if (!meter) return;
+        timed(measuring, [&] {
+            meter->submit(position, image, writer.old_image.get());
+        });
+    };
+
+    // the stages of the encode that --metrics reports on, next to the ones of
+    // the writer
+    std::optional<MetricsExport> metrics_export;
+    if (!metrics_file.empty()) {
+        metrics_export = MetricsExport::open(
+            metrics_file,
+            metrics_format == "prometheus" ? uppr::gif::METRICS_PROMETHEUS
+                                           : uppr::gif::METRICS_JSON,
+            metrics_interval);
+        if (!metrics_export) return 1;
+    }
+    auto maybe_report = [&](bool done) {
+        if (!metrics_export) return;
 
-    for (it++, frame++; it != input_files.end(); it++, frame++) {
-        data = std::unique_ptr<stbi_uc[], void (*)(stbi_uc *)>{
-            stbi_load(it->c_str(), &w, &h, &n, 4),
-            [](stbi_uc *a) { stbi_image_free(a); }};
+        auto const seconds =
+            std::chrono::duration<double>{steady_clock::now() - start}.count();
+        if (!done && !metrics_export->due(seconds)) return;
+
+        auto const pool = frame_pool().snapshot();
+        Metrics metrics;
+        metrics.seconds = seconds;
+        metrics.frames = writer.frame_count;
+        metrics.total_frames = source->size();
+        metrics.output_bytes = writer.output_bytes();
+        metrics.prefetched_frames = source->waiting();
+        metrics.measure_queue = meter ? meter->queued() : 0;
+        metrics.memory_bytes = pool.live_bytes;
+        metrics.peak_memory_bytes = pool.peak_live_bytes;
+        metrics.done = done;
+        metrics.stages = {
+            {"wait_for_frame", &waiting},
+            {"choose_disposal", &writer.stats.choosing},
+            {"compress", &writer.stats.compressing},
+            {"palette", &writer.stats.palettes},
+            {"map", &writer.stats.mapping},
+            {"measure", &measuring},
+            {"checkpoint", &checkpointing},
+        };
+
+        if (!metrics_export->report(metrics))
+            fprintf(stderr, "\nError writing metrics: %s\n",
+                    metrics_file.c_str());
+    };
 
-        if (!data) {
-            fprintf(stderr, "Error opening input file: %s\n", it->c_str());
+    auto const total_frames = source->size();
+    auto position = checkpoint.position;
+    writer.write_frame(frame_data(*first), crop.width, crop.height,
+                       first->delay, bit_depth, dithering);
+    maybe_measure(position, frame_data(*first));
+    maybe_checkpoint(++position);
+    first.reset();
+
+    maybe_report(false);
+
+    // the frame being written is only shown to people watching
+    auto const show_progress = progress || isatty(fileno(stdout));
+
+    usize frame_count{1};
+    for (;; ++frame_count) {
+        auto const frame = timed(waiting, [&] { return source->next(); });
+        if (!frame) break;
+        if (frame->width != width || frame->height != height) {
+            fprintf(stderr, "Input frame %zu has a different size\n",
+                    position);
             return 1;
         }
 
-        auto const p =
-            static_cast<double>(frame) / static_cast<double>(total_frames);
-        printf("Writing frame %d/%zu... (%.02f%%)\r", frame, total_frames,
-               p * 100);
-        fflush(stdout);
-        writer.write_frame(data.get(), w, h, delay, bit_depth, !dither);
+        if (show_progress && total_frames) {
+            auto const p = static_cast<double>(position) /
+                           static_cast<double>(*total_frames);
+            printf("Writing frame %zu/%zu... (%.02f%%)\r", position,
+                   *total_frames, p * 100);
+            fflush(stdout);
+        } else if (show_progress) {
+            printf("Writing frame %zu...\r", position);
+            fflush(stdout);
+        }
+        auto const image = frame_data(*frame);
+        writer.write_frame(image, crop.width, crop.height, frame->delay,
+                           bit_depth, dithering);
+        maybe_measure(position, image);
+        maybe_checkpoint(++position);
+        maybe_report(false);
     }
+    if (source->failed) return 1;
+
+    // the GIF is complete, there is nothing left to resume
+    writer.close();
+    if (checkpoint_every != 0 || resume) std::remove(checkpoint_file.c_str());
+    maybe_report(true);
 
     auto end = steady_clock::now();
     auto delta = duration_cast<milliseconds>(end - start).count();
-    printf("\ndone %lds (%.02fms/frame)\n", delta / 1000,
-           static_cast<double>(delta) /
-               static_cast<double>(input_files.size()));
+    if (show_progress) printf("\n");
+    printf("done %lds (%.02fms/frame)\n", delta / 1000,
+           static_cast<double>(delta) / static_cast<double>(frame_count));
+
+    auto const pool = frame_pool().snapshot();
+    auto const mib = [](usize bytes) {
+        return static_cast<double>(bytes) / (1 << 20);
+    };
+    printf("memory: %.1fMiB peak in use (%.1fMiB by stb_image, %.1fMiB by the "
+           "writer), %.1fMiB allocated (%.1fMiB in huge pages), %zu "
+           "allocations, %zu reused\n",
+           mib(pool.peak_live_bytes), mib(pool.peak_external_bytes),
+           mib(writer.stats.peak_memory), mib(pool.peak_reserved_bytes),
+           mib(pool.huge_page_bytes), pool.allocations, pool.reuses);
+    if (meter && !report_quality(meter->finish(), measure_csv)) return 1;
+    if (writer.stats.lzw_bytes != 0) {
+        printf("size estimates: off by %.2f%% of the image data, %.2f%% at "
+               "most on one frame\n",
+               100.0 * static_cast<double>(writer.stats.estimate_error) /
+                   static_cast<double>(writer.stats.lzw_bytes),
+               100.0 * writer.stats.max_estimate_error);
+    }
+    if (writer.stats.updated_palettes != 0) {
+        printf("%zu of %zu frames updated the palette of the frame before, "
+               "%zu of them without replacing a color\n",
+               writer.stats.updated_palettes, writer.frame_count,
+               writer.stats.kept_palettes);
+    }
+    if (writer.stats.sampled_frames != 0) {
+        printf("%zu frames had their palette built from samples to fit in "
+               "--max-memory\n",
+               writer.stats.sampled_frames);
+    }
 
     return 0;
 }
@@ -0,0 +1,208 @@
+#include "measure.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace uppr::gif {
+
+// === kernels ===
+//
+// These are written as plain loops over arrays with no branches inside, so
+// that the compiler turns them into SIMD code.
+
+/// Sum of the squared differences of the RGB channels of a row of `width`
+/// pixels. Background pixels of `output` are black.
+auto row_squared_error(u8 const *source, u8 const *output, usize width)
+    -> u64 {
+    u64 sum{};
+    for (usize i{}; i < width; ++i) {
+        auto const s = source + i * 4;
+        auto const o = output + i * 4;
+        // 0 for background, all ones for painted pixels
+        auto const painted = static_cast<u8>(o[3] != 0 ? 0xff : 0);
+
+        auto const dr = i32{s[0]} - i32{static_cast<u8>(o[0] & painted)};
+        auto const dg = i32{s[1]} - i32{static_cast<u8>(o[1] & painted)};
+        auto const db = i32{s[2]} - i32{static_cast<u8>(o[2] & painted)};
+        sum += static_cast<u32>(dr * dr + dg * dg + db * db);
+    }
+    return sum;
+}
+
+/// Converts a row of RGBA pixels to luma (BT.601, in 0-255). Background
+/// pixels are black.
+void row_luma(u8 const *rgba, usize width, bool background, u16 *out) {
+    for (usize i{}; i < width; ++i) {
+        auto const p = rgba + i * 4;
+        auto const painted = !background || p[3] != 0 ? 0xffffU : 0U;
+        auto const y = (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+        out[i] = static_cast<u16>(y & painted);
+    }
+}
+
+/// The sums SSIM needs over a block, kept for every column of a band of rows
+/// first and then added up per block.
+struct ColumnSums {
+    std::vector<u32> x;
+    std::vector<u32> y;
+    std::vector<u32> xx;
+    std::vector<u32> yy;
+    std::vector<u32> xy;
+
+    explicit ColumnSums(usize width)
+        : x(width), y(width), xx(width), yy(width), xy(width) {}
+
+    void clear() {
+        std::fill(x.begin(), x.end(), 0);
+        std::fill(y.begin(), y.end(), 0);
+        std::fill(xx.begin(), xx.end(), 0);
+        std::fill(yy.begin(), yy.end(), 0);
+        std::fill(xy.begin(), xy.end(), 0);
+    }
+
+    void add_row(u16 const *a, u16 const *b) {
+        auto const width = x.size();
+        for (usize i{}; i < width; ++i) {
+            u32 const ai = a[i];
+            u32 const bi = b[i];
+            x[i] += ai;
+            y[i] += bi;
+            xx[i] += ai * ai;
+            yy[i] += bi * bi;
+            xy[i] += ai * bi;
+        }
+    }
+};
+
+auto measure_quality(u8 const *source, u8 const *output, usize width,
+                     usize height) -> Quality {
+    // === PSNR ===
+    u64 squared_error{};
+    for (usize y{}; y < height; ++y) {
+        squared_error += row_squared_error(source + y * width * 4,
+                                           output + y * width * 4, width);
+    }
+
+    auto const mse = static_cast<double>(squared_error) /
+                     static_cast<double>(width * height * 3);
+    auto const psnr = mse == 0 ? std::numeric_limits<double>::infinity()
+                               : 10 * std::log10(255.0 * 255.0 / mse);
+
+    // === SSIM ===
+    // over 8x8 blocks that don't overlap, partial blocks at the edges are
+    // left out (unless the image is smaller than a block)
+    static constexpr usize block = 8;
+    static constexpr double c1 = (0.01 * 255) * (0.01 * 255);
+    static constexpr double c2 = (0.03 * 255) * (0.03 * 255);
+
+    auto const block_width = min(block, width);
+    auto const block_height = min(block, height);
+    auto const blocks_x = width / block_width;
+    auto const blocks_y = height / block_height;
+    auto const n = static_cast<double>(block_width * block_height);
+
+    std::vector<u16> luma_source(width);
+    std::vector<u16> luma_output(width);
+    ColumnSums sums{width};
+
+    double ssim_sum{};
+    for (usize by{}; by < blocks_y; ++by) {
+        sums.clear();
+        for (usize y{by * block_height}; y < (by + 1) * block_height; ++y) {
+            row_luma(source + y * width * 4, width, false, luma_source.data());
+            row_luma(output + y * width * 4, width, true, luma_output.data());
+            sums.add_row(luma_source.data(), luma_output.data());
+        }
+
+        for (usize bx{}; bx < blocks_x; ++bx) {
+            u64 sx{};
+            u64 sy{};
+            u64 sxx{};
+            u64 syy{};
+            u64 sxy{};
+            for (usize x{bx * block_width}; x < (bx + 1) * block_width; ++x) {
+                sx += sums.x[x];
+                sy += sums.y[x];
+                sxx += sums.xx[x];
+                syy += sums.yy[x];
+                sxy += sums.xy[x];
+            }
+
+            auto const mx = static_cast<double>(sx) / n;
+            auto const my = static_cast<double>(sy) / n;
+            auto const vx = static_cast<double>(sxx) / n - mx * mx;
+            auto const vy = static_cast<double>(syy) / n - my * my;
+            auto const cov = static_cast<double>(sxy) / n - mx * my;
+
+            ssim_sum += (2 * mx * my + c1) * (2 * cov + c2) /
+                        ((mx * mx + my * my + c1) * (vx + vy + c2));
+        }
+    }
+
+    auto const ssim = ssim_sum / static_cast<double>(blocks_x * blocks_y);
+
+    return {mse, psnr, ssim};
+}
+
+// === QualityMeter methods ===
+
+QualityMeter::QualityMeter(usize width, usize height)
+    : width{width}, height{height}, worker{[this] { work(); }} {}
+
+QualityMeter::~QualityMeter() { finish(); }
+
+void QualityMeter::submit(usize frame, u8 const *source, u8 const *output) {
+    auto const size = width * height * 4;
+
+    Job job{frame, frame_pool().acquire(size), frame_pool().acquire(size)};
+    memcpy(job.source.get(), source, size);
+    memcpy(job.output.get(), output, size);
+
+    {
+        std::unique_lock lock{mutex};
+        cv.wait(lock, [&] { return queue.size() < max_queued; });
+        queue.push_back(std::move(job));
+    }
+    cv.notify_all();
+}
+
+auto QualityMeter::queued() -> usize {
+    std::lock_guard lock{mutex};
+    return queue.size();
+}
+
+auto QualityMeter::finish() -> std::map<usize, Quality> const & {
+    {
+        std::lock_guard lock{mutex};
+        finishing = true;
+    }
+    cv.notify_all();
+
+    if (worker.joinable()) worker.join();
+    return results;
+}
+
+void QualityMeter::work() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock lock{mutex};
+            cv.wait(lock, [&] { return finishing || !queue.empty(); });
+            if (queue.empty()) return;
+
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        cv.notify_all();
+
+        auto const quality =
+            measure_quality(job.source.get(), job.output.get(), width, height);
+
+        std::lock_guard lock{mutex};
+        results.emplace(job.frame, quality);
+    }
+}
+
+} // namespace uppr::gif
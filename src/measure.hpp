@@ -0,0 +1,72 @@
+#pragma once
+
+#include "gif.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace uppr::gif {
+
+/// How close an output frame is to its source.
+struct Quality {
+    /// Mean squared error over the RGB channels.
+    double mse;
+    /// Peak signal to noise ratio in dB, infinite for identical frames.
+    double psnr;
+    /// Structural similarity of the luma, from 8x8 blocks. 1 for identical
+    /// frames.
+    double ssim;
+};
+
+/// Compares the RGB of two `width` by `height` RGBA images. Pixels with an
+/// alpha of 0 in `output` count as black, the background color of the GIF.
+auto measure_quality(u8 const *source, u8 const *output, usize width,
+                     usize height) -> Quality;
+
+/// Measures the quality of frames on a background thread, so that the
+/// encoder doesn't wait for it.
+struct QualityMeter {
+    /// At most this many frames wait to be measured, `submit` blocks after.
+    static constexpr usize max_queued = 4;
+
+    usize width;
+    usize height;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    struct Job {
+        usize frame;
+        Buffer source;
+        Buffer output;
+    };
+    std::deque<Job> queue;
+    bool finishing = false;
+    /// Qualities of the frames measured so far, by frame.
+    std::map<usize, Quality> results;
+
+    std::thread worker;
+
+    QualityMeter(usize width, usize height);
+    QualityMeter(QualityMeter const &) = delete;
+    auto operator=(QualityMeter const &) -> QualityMeter & = delete;
+    ~QualityMeter();
+
+    /// Queues frame `frame` to be measured. Both images are copied, so they
+    /// can change as soon as this returns.
+    void submit(usize frame, u8 const *source, u8 const *output);
+
+    /// How many frames wait to be measured.
+    auto queued() -> usize;
+
+    /// Waits for all queued frames to be measured, and returns the results.
+    auto finish() -> std::map<usize, Quality> const &;
+
+private:
+    void work();
+};
+
+} // namespace uppr::gif
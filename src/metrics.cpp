@@ -0,0 +1,197 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace uppr::gif {
+
+// === Latencies methods ===
+
+void Latencies::add(double seconds) {
+    auto const micros = seconds * 1e6;
+    auto const bucket =
+        micros < 1 ? 0.0
+                   : std::min(std::floor(std::log2(micros) * 4),
+                              static_cast<double>(buckets - 1));
+    ++counts[static_cast<usize>(bucket)];
+    ++count;
+    total += seconds;
+    max = std::max(max, seconds);
+}
+
+auto Latencies::percentile(double p) const -> double {
+    if (count == 0) return 0;
+
+    auto const rank =
+        static_cast<u64>(std::ceil(p * static_cast<double>(count)));
+    u64 seen{};
+    for (usize i{}; i < buckets; ++i) {
+        seen += counts[i];
+        if (seen >= std::max(rank, u64{1}))
+            return std::min(std::exp2(static_cast<double>(i + 1) / 4) / 1e6,
+                            max);
+    }
+
+    return max;
+}
+
+// === MetricsExport methods ===
+
+/// The percentiles that are reported for each stage, with their name in
+/// Prometheus and in JSON.
+struct Quantile {
+    double p;
+    char const *label;
+    char const *key;
+};
+constexpr Quantile quantiles[] = {
+    {0.5, "0.5", "p50"},
+    {0.9, "0.9", "p90"},
+    {0.99, "0.99", "p99"},
+};
+
+auto MetricsExport::open(std::string const &path, MetricsFormat format,
+                         double interval) -> std::optional<MetricsExport> {
+    MetricsExport metrics;
+    metrics.path = path;
+    metrics.format = format;
+    metrics.interval = interval;
+
+    if (format == METRICS_JSON) {
+        metrics.f = File{fopen(path.c_str(), "w"), fclose};
+        if (!metrics.f) {
+            fprintf(stderr, "Error writing %s\n", path.c_str());
+            return std::nullopt;
+        }
+    }
+
+    return metrics;
+}
+
+/// Writes `metrics` as a single line of JSON.
+void write_json(FILE *f, Metrics const &metrics, double fps) {
+    auto const average_fps =
+        metrics.seconds > 0
+            ? static_cast<double>(metrics.frames) / metrics.seconds
+            : 0;
+
+    fprintf(f, "{\"seconds\":%.3f,\"frames\":%zu,", metrics.seconds,
+            metrics.frames);
+    if (metrics.total_frames)
+        fprintf(f, "\"total_frames\":%zu,", *metrics.total_frames);
+    fprintf(f,
+            "\"fps\":%.3f,\"average_fps\":%.3f,\"output_bytes\":%zu,"
+            "\"prefetched_frames\":%zu,\"measure_queue\":%zu,"
+            "\"memory_bytes\":%zu,\"peak_memory_bytes\":%zu,\"done\":%s,"
+            "\"stages\":{",
+            fps, average_fps, metrics.output_bytes, metrics.prefetched_frames,
+            metrics.measure_queue, metrics.memory_bytes,
+            metrics.peak_memory_bytes, metrics.done ? "true" : "false");
+
+    for (usize i{}; i < metrics.stages.size(); ++i) {
+        auto const &[name, latencies] = metrics.stages[i];
+        fprintf(f, "%s\"%.*s\":{\"count\":%llu,\"seconds\":%.6f",
+                i == 0 ? "" : ",", static_cast<int>(name.size()), name.data(),
+                static_cast<unsigned long long>(latencies->count),
+                latencies->total);
+        for (auto const &[p, label, key] : quantiles) {
+            fprintf(f, ",\"%s\":%.6f", key, latencies->percentile(p));
+        }
+        fprintf(f, ",\"max\":%.6f}", latencies->max);
+    }
+
+    fputs("}}\n", f);
+}
+
+/// Writes `metrics` in the Prometheus text format.
+void write_prometheus(FILE *f, Metrics const &metrics, double fps) {
+    auto gauge = [&](char const *name, char const *help, double value) {
+        fprintf(f, "# HELP giffer_%s %s\n# TYPE giffer_%s gauge\n", name, help,
+                name);
+        fprintf(f, "giffer_%s %.9g\n", name, value);
+    };
+
+    auto const count = [](usize value) { return static_cast<double>(value); };
+    gauge("seconds", "Seconds since the encode started.", metrics.seconds);
+    gauge("frames", "Frames written so far.", count(metrics.frames));
+    if (metrics.total_frames)
+        gauge("total_frames", "Frames to write in all.",
+              count(*metrics.total_frames));
+    gauge("frames_per_second", "Frames written per second since the last "
+                               "report.",
+          fps);
+    gauge("output_bytes", "Bytes of the GIF so far.",
+          count(metrics.output_bytes));
+    gauge("prefetched_frames", "Frames decoded ahead, waiting to be written.",
+          count(metrics.prefetched_frames));
+    gauge("measure_queue", "Frames waiting to be measured.",
+          count(metrics.measure_queue));
+    gauge("memory_bytes", "Bytes of buffers in use.",
+          count(metrics.memory_bytes));
+    gauge("peak_memory_bytes", "Most bytes of buffers in use so far.",
+          count(metrics.peak_memory_bytes));
+    gauge("done", "1 once the GIF is complete.", metrics.done ? 1 : 0);
+
+    fputs("# HELP giffer_stage_seconds How long each run of a stage took.\n"
+          "# TYPE giffer_stage_seconds summary\n",
+          f);
+    for (auto const &[name, latencies] : metrics.stages) {
+        auto const stage = static_cast<int>(name.size());
+        for (auto const &[p, label, key] : quantiles) {
+            fprintf(f,
+                    "giffer_stage_seconds{stage=\"%.*s\",quantile=\"%s\"} "
+                    "%.9g\n",
+                    stage, name.data(), label, latencies->percentile(p));
+        }
+        fprintf(f, "giffer_stage_seconds_sum{stage=\"%.*s\"} %.9g\n", stage,
+                name.data(), latencies->total);
+        fprintf(f, "giffer_stage_seconds_count{stage=\"%.*s\"} %llu\n", stage,
+                name.data(), static_cast<unsigned long long>(latencies->count));
+    }
+
+    fputs("# HELP giffer_stage_max_seconds Longest run of a stage.\n"
+          "# TYPE giffer_stage_max_seconds gauge\n",
+          f);
+    for (auto const &[name, latencies] : metrics.stages) {
+        fprintf(f, "giffer_stage_max_seconds{stage=\"%.*s\"} %.9g\n",
+                static_cast<int>(name.size()), name.data(), latencies->max);
+    }
+}
+
+auto MetricsExport::report(Metrics const &metrics) -> bool {
+    auto const since = metrics.seconds - last_seconds.value_or(0);
+    auto const fps = since > 0 ? static_cast<double>(metrics.frames -
+                                                     last_frames) /
+                                     since
+                               : 0;
+    last_seconds = metrics.seconds;
+    last_frames = metrics.frames;
+
+    if (format == METRICS_JSON) {
+        write_json(f.get(), metrics, fps);
+        return fflush(f.get()) == 0;
+    }
+
+    // the textfile is replaced at once, so that it is never read half written
+    auto const temp = path + ".tmp";
+    {
+        auto const out = File{fopen(temp.c_str(), "w"), fclose};
+        if (!out) {
+            fprintf(stderr, "Error writing %s\n", temp.c_str());
+            return false;
+        }
+
+        write_prometheus(out.get(), metrics, fps);
+        if (fflush(out.get()) != 0) return false;
+    }
+
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Error writing %s\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace uppr::gif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace uppr::gif {
+
+/// How long the runs of one stage of the encoder took, counted in buckets a
+/// quarter of a power of two wide (starting from a microsecond), so the
+/// percentiles are at most 19% over the real ones.
+struct Latencies {
+    /// Up to about 4 minutes, longer runs go in the last bucket.
+    static constexpr usize buckets = 112;
+
+    std::array<u64, buckets> counts{};
+    u64 count = 0;
+    /// In seconds.
+    double total = 0;
+    double max = 0;
+
+    void add(double seconds);
+
+    /// The upper end of the bucket that the `p`th percentile (0 to 1) falls in,
+    /// in seconds. 0 when nothing has been added.
+    auto percentile(double p) const -> double;
+};
+
+/// Runs `f`, adds how long it took to `latencies`, and gives what it returned.
+template <typename F>
+auto timed(Latencies &latencies, F &&f) -> decltype(f()) {
+    struct Timer {
+        Latencies &latencies;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+        ~Timer() {
+            latencies.add(std::chrono::duration<double>{
+                std::chrono::steady_clock::now() - start}
+                              .count());
+        }
+    } timer{latencies};
+
+    return f();
+}
+
+/// How an encode is going, as `MetricsExport` reports it.
+struct Metrics {
+    /// Since the encode started.
+    double seconds = 0;
+    /// Frames given to the writer so far, and in all when it is known.
+    usize frames = 0;
+    std::optional<usize> total_frames;
+    /// Bytes of the GIF so far.
+    usize output_bytes = 0;
+    /// Frames decoded ahead and waiting for the writer, and frames waiting to
+    /// be measured.
+    usize prefetched_frames = 0;
+    usize measure_queue = 0;
+    /// Bytes of the buffers in use, now and at most so far.
+    usize memory_bytes = 0;
+    usize peak_memory_bytes = 0;
+    /// Whether the GIF is complete.
+    bool done = false;
+    /// The stages of the encode, by name.
+    std::vector<std::pair<std::string_view, Latencies const *>> stages;
+};
+
+/// Where `MetricsExport` writes to.
+enum MetricsFormat {
+    /// A JSON object per line, appended to the file for each report.
+    METRICS_JSON,
+    /// A Prometheus textfile (for node_exporter's textfile collector),
+    /// replaced by each report.
+    METRICS_PROMETHEUS,
+};
+
+/// Writes the metrics of an encode to a file every `interval` seconds, for
+/// whatever watches over long encodes.
+struct MetricsExport {
+    using File = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+    std::string path;
+    MetricsFormat format = METRICS_JSON;
+    double interval = 1;
+
+    /// The JSON lines, kept open between reports.
+    File f = {nullptr, fclose};
+    /// When the last report was written, and how many frames there were.
+    std::optional<double> last_seconds;
+    usize last_frames = 0;
+
+    /// Starts writing to `path`, emptying it for JSON lines. Any path works,
+    /// like `/dev/fd/3` for a descriptor that the caller opened.
+    static auto open(std::string const &path, MetricsFormat format,
+                     double interval) -> std::optional<MetricsExport>;
+
+    /// Whether it is time for the next report.
+    auto due(double seconds) const -> bool {
+        return !last_seconds || seconds - *last_seconds >= interval;
+    }
+
+    /// Writes a report. Frames per second are counted since the one before.
+    auto report(Metrics const &metrics) -> bool;
+};
+
+} // namespace uppr::gif
@@ -0,0 +1,236 @@
+#include "soak.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace uppr::gif {
+
+/// Repeats the frames of another source without end.
+struct LoopSource : IndexedSource {
+    std::unique_ptr<IndexedSource> inner;
+
+    explicit LoopSource(std::unique_ptr<IndexedSource> inner)
+        : inner{std::move(inner)} {}
+
+    auto count() const -> usize override { return SIZE_MAX; }
+    auto load(usize i) -> std::optional<Frame> override {
+        return inner->load(i % inner->count());
+    }
+};
+
+/// Bytes of the process that are in memory, from `/proc/self/statm`. Nothing
+/// where that can't be read.
+auto resident_bytes() -> std::optional<usize> {
+#if defined(__linux__)
+    auto const f = std::unique_ptr<FILE, int (*)(FILE *)>{
+        fopen("/proc/self/statm", "r"), fclose};
+    if (!f) return std::nullopt;
+
+    unsigned long long pages{}, resident{};
+    if (fscanf(f.get(), "%llu %llu", &pages, &resident) != 2)
+        return std::nullopt;
+
+    return static_cast<usize>(resident) *
+           static_cast<usize>(sysconf(_SC_PAGESIZE));
+#else
+    return std::nullopt;
+#endif
+}
+
+/// How the soak was going at the end of one interval.
+struct SoakSample {
+    double seconds;
+    usize frames;
+    /// Frames written per second during the interval.
+    double fps;
+    std::optional<usize> resident;
+    BufferPool::Stats pool;
+};
+
+/// The median of `values`, which are reordered.
+auto median(std::vector<double> values) -> double {
+    if (values.empty()) return 0;
+
+    auto const middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    return *middle;
+}
+
+auto to_mib(usize bytes) -> double {
+    return static_cast<double>(bytes) / (1 << 20);
+}
+
+auto soak(SoakOptions const &options) -> bool {
+    auto const [width, height, content, dither, seconds, interval, max_drift,
+                max_growth, max_allocations] = options;
+    usize const delay = 2;
+
+    if (seconds < interval * soak_min_samples) {
+        fprintf(stderr,
+                "%.0f seconds only give %zu samples of %g seconds, the soak "
+                "needs at least %zu\n",
+                seconds, static_cast<usize>(seconds / interval), interval,
+                soak_min_samples);
+        return false;
+    }
+
+    // enough different frames that every one of them changes, without drawing
+    // (and keeping) more than the decode threads can keep up with
+    auto const decode_threads =
+        max(static_cast<usize>(std::thread::hardware_concurrency()), usize{1});
+    PrefetchSource source{
+        std::make_unique<LoopSource>(std::make_unique<SyntheticSource>(
+            width, height, 256, delay, content)),
+        decode_threads, 8};
+
+#if defined(_WIN32)
+    auto const null_path = "NUL";
+#else
+    auto const null_path = "/dev/null";
+#endif
+    auto writer = Writer::open(null_path, width, height, delay, 8, dither);
+    if (!writer) {
+        fprintf(stderr, "Error writing %s\n", null_path);
+        return false;
+    }
+
+    auto const content_name =
+        std::ranges::find_if(synthetic_contents, [&](auto const &c) {
+            return c.first == content;
+        })->second;
+    printf("Encoding synthetic %zux%zu %s frames%s for %.0f seconds\n\n",
+           width, height, content_name.data(), dither ? ", dithered," : "",
+           seconds);
+    printf("  %8s %10s %10s %12s %12s %8s\n", "seconds", "frames", "frames/s",
+           "resident", "pool", "allocs");
+
+    std::vector<SoakSample> samples;
+    auto const start = std::chrono::steady_clock::now();
+    auto elapsed = [&] {
+        return std::chrono::duration<double>{std::chrono::steady_clock::now() -
+                                             start}
+            .count();
+    };
+
+    usize frames{};
+    double last_seconds{};
+    usize last_frames{};
+    while (true) {
+        auto const frame = source.next();
+        if (!frame) {
+            fprintf(stderr, "Failed to draw frame %zu\n", frames);
+            return false;
+        }
+        writer->write_frame(frame->pixels.get(), width, height, frame->delay,
+                            8, dither);
+        ++frames;
+
+        auto const now = elapsed();
+        if (now - last_seconds < interval) continue;
+
+        SoakSample const sample{
+            now, frames,
+            static_cast<double>(frames - last_frames) / (now - last_seconds),
+            resident_bytes(), frame_pool().snapshot()};
+        samples.push_back(sample);
+        last_seconds = now;
+        last_frames = frames;
+
+        printf("  %8.1f %10zu %10.2f", sample.seconds, sample.frames,
+               sample.fps);
+        if (sample.resident)
+            printf(" %10.1fMi", to_mib(*sample.resident));
+        else
+            printf(" %12s", "-");
+        printf(" %10.1fMi %8zu\n", to_mib(sample.pool.reserved_bytes),
+               sample.pool.allocations);
+        fflush(stdout);
+
+        if (now >= seconds) break;
+    }
+    if (!writer->close()) {
+        fprintf(stderr, "Error writing %s\n", null_path);
+        return false;
+    }
+
+    // the first sample is the warm-up: the buffers are being allocated and the
+    // caches filled, so the others are compared to it
+    auto const &warm = samples.front();
+    auto const &last = samples.back();
+    bool passed = true;
+
+    printf("\n");
+    if (samples.size() < soak_min_samples) {
+        // the frames were too slow to take enough, nothing has been checked
+        printf("Only %zu samples, too few to tell whether the throughput "
+               "drifts\n  FAILED: run for longer or take samples more "
+               "often\n",
+               samples.size());
+        passed = false;
+    } else {
+        // medians, so that a single slow interval (another process waking up)
+        // doesn't count as drift
+        auto const middle = samples.begin() + 1 + (samples.size() - 1) / 2;
+        std::vector<double> first, second;
+        for (auto it = samples.begin() + 1; it != middle; ++it) {
+            first.push_back(it->fps);
+        }
+        for (auto it = middle; it != samples.end(); ++it) {
+            second.push_back(it->fps);
+        }
+        auto const before = median(first);
+        auto const after = median(second);
+        auto const drift = before > 0 ? (before - after) / before : 0;
+
+        printf("Throughput: %.2f frames/s in the first half, %.2f in the "
+               "second (%+.1f%%, at most -%.0f%%)\n",
+               before, after, -drift * 100, max_drift * 100);
+        if (drift > max_drift) {
+            printf("  FAILED: the encoder slows down as it goes\n");
+            passed = false;
+        }
+    }
+
+    if (warm.resident && last.resident) {
+        auto const growth = *last.resident > *warm.resident
+                                ? *last.resident - *warm.resident
+                                : 0;
+        printf("Resident memory: %.1fMi after warming up, %.1fMi at the end "
+               "(%+.1fMi, at most +%.1fMi)\n",
+               to_mib(*warm.resident), to_mib(*last.resident),
+               to_mib(*last.resident) - to_mib(*warm.resident),
+               to_mib(max_growth));
+        if (growth > max_growth) {
+            printf("  FAILED: memory keeps growing\n");
+            passed = false;
+        }
+    } else {
+        printf("Resident memory: unknown on this system\n");
+    }
+
+    auto const allocations = last.pool.allocations - warm.pool.allocations;
+    printf("Buffers: %zu allocated (at most %zu) and %zu reused after warming "
+           "up, %.1fMi reserved at the end (%.1fMi at most)\n",
+           allocations, max_allocations, last.pool.reuses - warm.pool.reuses,
+           to_mib(last.pool.reserved_bytes),
+           to_mib(last.pool.peak_reserved_bytes));
+    if (allocations > max_allocations) {
+        printf("  FAILED: buffers are allocated instead of reused\n");
+        passed = false;
+    }
+    printf("Writer: %.1fMi of buffers at most, %zu frames in %.1f seconds\n",
+           to_mib(writer->stats.peak_memory), frames, last.seconds);
+
+    printf("\n%s\n", passed ? "Throughput, memory and buffers stayed stable"
+                            : "Throughput, memory or buffers drifted");
+    return passed;
+}
+
+} // namespace uppr::gif
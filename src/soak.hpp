@@ -0,0 +1,43 @@
+#pragma once
+
+#include "frame_source.hpp"
+#include "gif.hpp"
+
+namespace uppr::gif {
+
+/// What `soak` encodes, and what it takes for a failure.
+struct SoakOptions {
+    /// Size of the synthetic frames, and what they show.
+    usize width = 640;
+    usize height = 480;
+    /// A UI by default, as small changes take more paths through the encoder
+    /// (and its buffers) than whole frames changing do.
+    SyntheticContent content = CONTENT_UI;
+    bool dither = false;
+    /// How long to encode for, and how often to take a sample, in seconds.
+    double seconds = 60;
+    double interval = 5;
+    /// Most the frames per second of the second half of the samples can be
+    /// below the first half, as a fraction of it.
+    double max_drift = 0.2;
+    /// Most the resident memory can grow after the first sample, in bytes.
+    usize max_growth = usize{16} << 20;
+    /// Most blocks the frame pool can allocate after the first sample. Once
+    /// warmed up it should reuse its blocks, leaks show up here long before
+    /// they do in the resident memory.
+    usize max_allocations = 64;
+};
+
+/// Samples `soak` needs: one to warm up, and two for each half of the run to
+/// be compared.
+constexpr usize soak_min_samples = 5;
+
+/// Encodes synthetic frames without end to a null sink for `options.seconds`,
+/// like an encode of millions of frames, and prints the frames per second,
+/// resident memory and buffer allocations every `options.interval` seconds.
+/// The first sample is taken as the warm-up, the others are compared to it.
+/// Returns whether the throughput and memory stayed within the limits, which
+/// fails when `options.seconds` is too short for `soak_min_samples` samples.
+auto soak(SoakOptions const &options) -> bool;
+
+} // namespace uppr::gif
@@ -1,2 +1,13 @@
+#include <stddef.h>
+
+// allocations of stb_image go through giffer, so that they are accounted for
+void *giffer_stbi_malloc(size_t size);
+void *giffer_stbi_realloc(void *p, size_t size);
+void giffer_stbi_free(void *p);
+
+#define STBI_MALLOC(sz) giffer_stbi_malloc(sz)
+#define STBI_REALLOC(p, newsz) giffer_stbi_realloc(p, newsz)
+#define STBI_FREE(p) giffer_stbi_free(p)
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -0,0 +1,383 @@
+#include "frame_source.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <vector>
+
+namespace uppr::gif {
+
+// === drawing helpers ===
+
+/// An RGB color.
+struct Color {
+    u8 r;
+    u8 g;
+    u8 b;
+};
+
+/// Mixes the bits of `x` (the lowbias32 hash), for patterns that look random
+/// but are the same on every run and every machine.
+constexpr auto mix(u32 x) -> u32 {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+/// Fills the part of `rect` that is inside of a `width` by `height` image.
+void fill_rect(u8 *image, usize width, usize height, Rect const &rect,
+               Color color) {
+    auto const inside = rect.intersect(Rect{0, 0, width, height});
+    for (auto y = inside.top; y < inside.bottom(); ++y) {
+        auto const row = image + (y * width + inside.left) * 4;
+        for (usize x{}; x < inside.width; ++x) {
+            row[x * 4 + 0] = color.r;
+            row[x * 4 + 1] = color.g;
+            row[x * 4 + 2] = color.b;
+            row[x * 4 + 3] = 255;
+        }
+    }
+}
+
+/// Goes from 0 to `range` and back as `t` grows, for things that bounce
+/// between the edges of the frame.
+constexpr auto bounce(usize t, usize range) -> usize {
+    if (range == 0) return 0;
+
+    auto const p = t % (2 * range);
+    return p < range ? p : 2 * range - p;
+}
+
+/// Clamps `value` to a color channel.
+constexpr auto channel(int value) -> u8 {
+    return static_cast<u8>(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// === content types ===
+//
+// Each one draws frame `i` into `image`. Per pixel work is kept to lookups and
+// integer math in loops over rows, so that it vectorizes, with anything more
+// expensive computed once per row or column.
+
+void draw_gradient(u8 *image, usize width, usize height, usize i) {
+    // this is the default shadertoy - credit to shadertoy.com. Red and blue
+    // only depend on the column, green on the row
+    auto const tt = static_cast<float>(i) * 3.14159F * 2 / 255.0F;
+    auto const unorm = [](float f) {
+        return static_cast<u8>(roundf(255.0F * f));
+    };
+
+    std::vector<u8> red(width);
+    std::vector<u8> blue(width);
+    for (usize x{}; x < width; ++x) {
+        float fx = static_cast<float>(x) / width;
+        red[x] = unorm(0.5F + 0.5F * cosf(tt + fx));
+        blue[x] = unorm(0.5F + 0.5F * cosf(tt + fx + 4.F));
+    }
+
+    for (usize y{}; y < height; ++y) {
+        float fy = static_cast<float>(y) / height;
+        auto const green = unorm(0.5F + 0.5F * cosf(tt + fy + 2.F));
+
+        // green and blue are swapped, as they always have been in the example
+        auto const row = image + y * width * 4;
+        for (usize x{}; x < width; ++x) {
+            row[x * 4 + 0] = red[x];
+            row[x * 4 + 1] = blue[x];
+            row[x * 4 + 2] = green;
+            row[x * 4 + 3] = 255;
+        }
+    }
+}
+
+void draw_noise(u8 *image, usize width, usize height, usize i) {
+    auto const seed = mix(static_cast<u32>(i));
+    for (usize y{}; y < height; ++y) {
+        auto const row = image + y * width * 4;
+        auto const first = static_cast<u32>(y * width);
+        for (usize x{}; x < width; ++x) {
+            auto const v = mix((first + static_cast<u32>(x)) ^ seed);
+            row[x * 4 + 0] = static_cast<u8>(v);
+            row[x * 4 + 1] = static_cast<u8>(v >> 8);
+            row[x * 4 + 2] = static_cast<u8>(v >> 16);
+            row[x * 4 + 3] = 255;
+        }
+    }
+}
+
+void draw_ui(u8 *image, usize width, usize height, usize i) {
+    auto fill = [&](Rect const &rect, Color color) {
+        fill_rect(image, width, height, rect, color);
+    };
+
+    fill({0, 0, width, height}, {236, 236, 236});
+
+    // title bar with its buttons on the right
+    auto const bar = min(max(height / 16, usize{2}), height);
+    fill({0, 0, width, bar}, {45, 52, 64});
+    Color const buttons[] = {{237, 106, 94}, {245, 191, 79}, {98, 197, 84}};
+    for (usize k{}; k < 3 && (k + 1) * bar <= width; ++k) {
+        fill({width - (k + 1) * bar + bar / 4, bar / 4, bar / 2, bar / 2},
+             buttons[k]);
+    }
+
+    // sidebar with a list of items
+    auto const side = width / 5;
+    fill({0, bar, side, height - bar}, {222, 226, 231});
+    for (usize k{}, y{bar + bar / 2}; y + bar / 2 < height; ++k, y += bar) {
+        auto const length = side * (40 + mix(static_cast<u32>(k)) % 40) / 100;
+        fill({bar / 2, y, length, max(bar / 3, usize{1})}, {150, 156, 165});
+    }
+
+    // cards with lines of text in them, in a 3x2 grid
+    auto const area = Rect{side, bar, width - side, height - bar};
+    auto const gap = max(area.width / 40, usize{1});
+    auto const card_width = area.width > gap * 4 ? (area.width - gap * 4) / 3
+                                                 : usize{};
+    auto const card_height =
+        area.height > gap * 3 ? (area.height - gap * 3) / 2 : usize{};
+    auto const line = max(card_height / 10, usize{2});
+
+    for (usize card{}; card < 6; ++card) {
+        auto const rect = Rect{
+            area.left + gap + (card % 3) * (card_width + gap),
+            area.top + gap + (card / 3) * (card_height + gap),
+            card_width,
+            card_height,
+        };
+        if (rect.width < 2 || rect.height < 2) continue;
+
+        fill(rect, {200, 200, 200});
+        fill({rect.left + 1, rect.top + 1, rect.width - 2, rect.height - 2},
+             {255, 255, 255});
+
+        for (usize l{}, y{rect.top + line};
+             rect.width > gap * 2 && y + line < rect.bottom();
+             ++l, y += line) {
+            auto const percent = 40 + mix(static_cast<u32>(card * 16 + l)) % 60;
+            auto const length = (rect.width - gap * 2) * percent / 100;
+            fill({rect.left + gap, y, length, max(line / 2, usize{1})},
+                 l == 0 ? Color{40, 40, 40} : Color{120, 120, 120});
+        }
+    }
+
+    // a caret blinking after the title of the first card
+    if ((i / 15) % 2 == 0 && card_width > gap * 3) {
+        fill({area.left + gap * 2 + (card_width - gap * 2) / 2,
+              area.top + gap + line - line / 4, max(line / 6, usize{1}), line},
+             {30, 30, 30});
+    }
+
+    // the mouse cursor, an arrow with a dark outline bouncing around
+    auto const size = max(min(width, height) / 32, usize{6});
+    auto const cx = bounce(i * 7, width > size ? width - size : 0);
+    auto const cy = bounce(i * 5, height > size ? height - size : 0);
+    for (usize r{}; r < size && cy + r < height; ++r) {
+        auto const span = r * 2 / 3;
+        for (usize c{}; c <= span && cx + c < width; ++c) {
+            auto const edge = c == 0 || c == span || r + 1 == size;
+            fill({cx + c, cy + r, 1, 1},
+                 edge ? Color{0, 0, 0} : Color{255, 255, 255});
+        }
+    }
+}
+
+/// A 5x7 glyph made up for character `id`, one bit per pixel row by row.
+constexpr auto glyph(u32 id) -> u64 {
+    return (u64{mix(id * 2)} << 32 | mix(id * 2 + 1)) & ((u64{1} << 35) - 1);
+}
+
+void draw_text(u8 *image, usize width, usize height, usize i) {
+    // glyphs are 5x7 pixels in cells of 6x12, scaled up for large frames
+    auto const scale = max(height / 360, usize{1});
+    auto const cell_width = 6 * scale;
+    auto const cell_height = 12 * scale;
+    auto const margin = cell_width * 2;
+    auto const columns = width > margin * 2 ? (width - margin * 2) / cell_width
+                                            : usize{};
+    auto const scroll = i * 2 * scale;
+
+    fill_rect(image, width, height, {0, 0, width, height}, {250, 250, 250});
+    for (usize y{}; y < height; ++y) {
+        auto const row = image + y * width * 4;
+
+        // which line of the text this is and the row of its glyphs, which
+        // have some space above and below them
+        auto const ty = y + scroll;
+        auto const text_line = static_cast<u32>(ty / cell_height);
+        auto const glyph_row = (ty % cell_height) / scale;
+        if (glyph_row < 2 || glyph_row >= 9) continue;
+
+        // some lines are empty, some are links, and all have their own length
+        auto const kind = mix(text_line);
+        if (kind % 9 == 0) continue;
+        auto const ink =
+            kind % 5 == 0 ? Color{30, 90, 200} : Color{30, 30, 30};
+        auto const length = columns / 2 + kind % (columns / 2 + 1);
+
+        for (usize col{}; col < length; ++col) {
+            auto const ch = mix(text_line * 1000 + static_cast<u32>(col));
+            if (ch % 6 == 0) continue; // a space
+
+            auto const bits = glyph(ch % 64) >> ((glyph_row - 2) * 5);
+            auto const left = margin + col * cell_width;
+            for (usize gx{}; gx < 5 * scale; ++gx) {
+                if (((bits >> (gx / scale)) & 1) == 0) continue;
+
+                auto const pixel = row + (left + gx) * 4;
+                pixel[0] = ink.r;
+                pixel[1] = ink.g;
+                pixel[2] = ink.b;
+            }
+        }
+    }
+}
+
+/// The 16 colors of the PICO-8 fantasy console.
+constexpr Color pico8[] = {
+    {0, 0, 0},       {29, 43, 83},    {126, 37, 83},   {0, 135, 81},
+    {171, 82, 54},   {95, 87, 79},    {194, 195, 199}, {255, 241, 232},
+    {255, 0, 77},    {255, 163, 0},   {255, 236, 39},  {0, 228, 54},
+    {41, 173, 255},  {131, 118, 156}, {255, 119, 168}, {255, 204, 170},
+};
+
+void draw_pixel_art(u8 *image, usize width, usize height, usize i) {
+    // the scene is drawn in big square cells, one palette index each
+    auto const scale = max(min(width, height) / 64, usize{1});
+    auto const cols = (width + scale - 1) / scale;
+    auto const rows = (height + scale - 1) / scale;
+    auto const horizon = rows * 3 / 4;
+
+    std::vector<u8> cells(cols * rows);
+    for (usize y{}; y < rows; ++y) {
+        for (usize x{}; x < cols; ++x) {
+            u8 color = 12; // sky
+            auto const cloud = mix(static_cast<u32>(x / 6 + y / 3 * 97));
+            if (y < rows / 3 && cloud % 5 == 0) color = 7;
+
+            if (y == horizon) color = 11; // grass
+            if (y > horizon) color = (x + y) % 4 == 0 ? 5 : 4; // dirt
+
+            cells[y * cols + x] = color;
+        }
+    }
+
+    // an 8x8 symmetric sprite walking to the right, moving its legs
+    u8 const sprite[8][8] = {
+        {0, 0, 8, 8, 8, 8, 0, 0}, {0, 8, 8, 8, 8, 8, 8, 0},
+        {8, 8, 7, 0, 0, 7, 8, 8}, {8, 8, 8, 8, 8, 8, 8, 8},
+        {8, 14, 8, 8, 8, 8, 14, 8}, {0, 8, 8, 8, 8, 8, 8, 0},
+        {0, 8, 8, 0, 0, 8, 8, 0}, {8, 8, 0, 0, 0, 0, 8, 8},
+    };
+    auto const step = (i / 4) % 2;
+    auto const sx = static_cast<long>((i / 2) % (cols + 8)) - 8;
+    auto const sy = static_cast<long>(horizon) - 8;
+    for (usize r{}; r < 8; ++r) {
+        // the last row alternates between feet apart and together
+        auto const from = r == 7 && step ? 6 : r;
+        for (usize c{}; c < 8; ++c) {
+            auto const color = sprite[from][c];
+            auto const x = sx + static_cast<long>(c);
+            auto const y = sy + static_cast<long>(r);
+            if (color == 0 || x < 0 || y < 0 || x >= static_cast<long>(cols))
+                continue;
+
+            cells[static_cast<usize>(y) * cols + static_cast<usize>(x)] =
+                color;
+        }
+    }
+
+    // scale up, each row of cells is drawn once and copied to the rows below
+    for (usize y{}; y < height; y += scale) {
+        auto const cell_row = cells.data() + (y / scale) * cols;
+        auto const row = image + y * width * 4;
+        for (usize x{}; x < width; ++x) {
+            auto const color = pico8[cell_row[x / scale]];
+            row[x * 4 + 0] = color.r;
+            row[x * 4 + 1] = color.g;
+            row[x * 4 + 2] = color.b;
+            row[x * 4 + 3] = 255;
+        }
+
+        for (auto copy = y + 1; copy < min(y + scale, height); ++copy) {
+            memcpy(image + copy * width * 4, row, width * 4);
+        }
+    }
+}
+
+void draw_video(u8 *image, usize width, usize height, usize i) {
+    // the background is a soft pattern with fixed grain on top, the same in
+    // every frame
+    constexpr auto pi = std::numbers::pi_v<float>;
+    std::vector<int> column(width);
+    for (usize x{}; x < width; ++x) {
+        column[x] =
+            static_cast<int>(40 * cosf(static_cast<float>(x) / width * 2 * pi));
+    }
+
+    for (usize y{}; y < height; ++y) {
+        auto const fy = static_cast<float>(y) / height;
+        auto const wave = static_cast<int>(30 * cosf(fy * 3 * pi));
+        auto const row = image + y * width * 4;
+        auto const first = static_cast<u32>(y * width);
+        for (usize x{}; x < width; ++x) {
+            auto const grain =
+                static_cast<int>(mix(first + static_cast<u32>(x)) & 15) - 8;
+            row[x * 4 + 0] = channel(110 + column[x] + wave + grain);
+            row[x * 4 + 1] = channel(120 + column[x] / 2 - wave + grain);
+            row[x * 4 + 2] = channel(90 - column[x] / 2 + wave / 2 + grain);
+            row[x * 4 + 3] = 255;
+        }
+    }
+
+    // a ball lit from the top left, going around the middle of the frame
+    auto const t = static_cast<float>(i) * 0.05F;
+    auto const radius =
+        static_cast<float>(max(min(width, height) / 10, usize{2}));
+    auto const bx = static_cast<float>(width) * (0.5F + 0.3F * cosf(t));
+    auto const by = static_cast<float>(height) * (0.5F + 0.25F * sinf(2 * t));
+
+    auto const top = static_cast<usize>(max(by - radius, 0.0F));
+    auto const bottom = min(static_cast<usize>(by + radius) + 1, height);
+    auto const left = static_cast<usize>(max(bx - radius, 0.0F));
+    auto const right = min(static_cast<usize>(bx + radius) + 1, width);
+    for (auto y = top; y < bottom; ++y) {
+        for (auto x = left; x < right; ++x) {
+            auto const nx = (static_cast<float>(x) - bx) / radius;
+            auto const ny = (static_cast<float>(y) - by) / radius;
+            auto const nz2 = 1 - nx * nx - ny * ny;
+            if (nz2 < 0) continue;
+
+            auto const light =
+                max(-0.4F * nx - 0.5F * ny + 0.77F * sqrtf(nz2), 0.0F);
+            auto const shade = 0.25F + 0.75F * light;
+            auto const pixel = image + (y * width + x) * 4;
+            pixel[0] = channel(static_cast<int>(220 * shade));
+            pixel[1] = channel(static_cast<int>(70 * shade));
+            pixel[2] = channel(static_cast<int>(50 * shade));
+        }
+    }
+}
+
+// === SyntheticSource methods ===
+
+auto SyntheticSource::load(usize i) -> std::optional<Frame> {
+    Frame frame{pool.acquire(width * height * 4), width, height, delay};
+    auto const image = frame.pixels.get();
+
+    switch (content) {
+    case CONTENT_GRADIENT: draw_gradient(image, width, height, i); break;
+    case CONTENT_NOISE: draw_noise(image, width, height, i); break;
+    case CONTENT_UI: draw_ui(image, width, height, i); break;
+    case CONTENT_TEXT: draw_text(image, width, height, i); break;
+    case CONTENT_PIXEL_ART: draw_pixel_art(image, width, height, i); break;
+    case CONTENT_VIDEO: draw_video(image, width, height, i); break;
+    }
+
+    return frame;
+}
+
+} // namespace uppr::gif
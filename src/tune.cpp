@@ -0,0 +1,350 @@
+#include "tune.hpp"
+#include "frame_source.hpp"
+#include "measure.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+namespace uppr::gif {
+
+// === profile files ===
+
+auto tuning_path() -> std::string {
+    if (auto const *config = std::getenv("XDG_CONFIG_HOME");
+        config && *config)
+        return std::string{config} + "/giffer/tune.conf";
+
+    if (auto const *home = std::getenv("HOME"); home && *home)
+        return std::string{home} + "/.config/giffer/tune.conf";
+
+    return {};
+}
+
+/// Names of the `Search` methods in profiles.
+constexpr std::pair<Search, std::string_view> search_names[] = {
+    {Search::tree, "tree"},
+    {Search::cache, "cache"},
+};
+
+/// The name of `search` in profiles.
+auto search_name(Search search) -> std::string_view {
+    for (auto const &[s, name] : search_names) {
+        if (s == search) return name;
+    }
+    return "auto";
+}
+
+/// Parses a count, or `all` for no limit.
+auto parse_count(std::string_view text) -> std::optional<usize> {
+    if (text == "all") return SIZE_MAX;
+
+    usize value{};
+    auto const [end, error] =
+        std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc{} || end != text.data() + text.size() || value == 0)
+        return std::nullopt;
+
+    return value;
+}
+
+/// Removes the spaces around `text`.
+auto trim(std::string_view text) -> std::string_view {
+    auto const first = text.find_first_not_of(" \t\r");
+    if (first == std::string_view::npos) return {};
+
+    auto const last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+auto read_tuning(std::string const &path) -> std::optional<Tuning> {
+    auto const f = std::unique_ptr<FILE, int (*)(FILE *)>{
+        fopen(path.c_str(), "r"), fclose};
+    if (!f) return std::nullopt;
+
+    Tuning tuning;
+    std::array<char, 256> buffer{};
+    for (usize line{1}; fgets(buffer.data(), buffer.size(), f.get()); ++line) {
+        auto const text = trim(std::string_view{buffer.data()}.substr(
+            0, std::string_view{buffer.data()}.find_first_of("#\n")));
+        if (text.empty()) continue;
+
+        auto const equals = text.find('=');
+        auto const key = trim(text.substr(0, equals));
+        auto const value = equals == std::string_view::npos
+                               ? std::string_view{}
+                               : trim(text.substr(equals + 1));
+
+        auto const count = key == "threads"          ? &tuning.threads
+                           : key == "stripe-rows"    ? &tuning.stripe_rows
+                           : key == "palette-pixels" ? &tuning.palette_pixels
+                                                     : nullptr;
+
+        auto valid = true;
+        if (count) {
+            auto const parsed = parse_count(value);
+            valid = parsed.has_value();
+            if (valid) *count = *parsed;
+        } else if (key == "search") {
+            auto const it = std::ranges::find_if(
+                search_names, [&](auto const &s) { return s.second == value; });
+            valid = it != std::end(search_names);
+            if (valid) tuning.search = it->first;
+        }
+
+        if (!valid) {
+            fprintf(stderr, "Invalid setting in %s, line %zu: %.*s\n",
+                    path.c_str(), line, static_cast<int>(text.size()),
+                    text.data());
+            return std::nullopt;
+        }
+    }
+
+    return tuning;
+}
+
+auto write_tuning(std::string const &path, Tuning const &tuning) -> bool {
+    std::error_code error;
+    std::filesystem::create_directories(
+        std::filesystem::path{path}.parent_path(), error);
+
+    auto const f = std::unique_ptr<FILE, int (*)(FILE *)>{
+        fopen(path.c_str(), "w"), fclose};
+    if (!f) {
+        fprintf(stderr, "Error writing %s\n", path.c_str());
+        return false;
+    }
+
+    auto const count = [](usize value) {
+        return value == SIZE_MAX ? std::string{"all"} : std::to_string(value);
+    };
+    fprintf(f.get(), "# written by `giffer tune`, run it again to update\n");
+    fprintf(f.get(), "threads = %zu\n", tuning.threads);
+    fprintf(f.get(), "stripe-rows = %zu\n", tuning.stripe_rows);
+    fprintf(f.get(), "search = %s\n", search_name(tuning.search).data());
+    fprintf(f.get(), "palette-pixels = %s\n",
+            count(tuning.palette_pixels).c_str());
+
+    return fflush(f.get()) == 0;
+}
+
+auto host_tuning() -> Tuning const & {
+    static Tuning const tuning = [] {
+        auto const path = tuning_path();
+        if (path.empty()) return Tuning{};
+
+        return read_tuning(path).value_or(Tuning{});
+    }();
+
+    return tuning;
+}
+
+// === benchmarks ===
+
+/// Runs `f` `repeats` times, and gives how long the fastest run took in
+/// milliseconds.
+template <typename F>
+auto fastest(usize repeats, F &&f) -> double {
+    auto best = std::chrono::steady_clock::duration::max();
+    for (usize i{}; i < repeats; ++i) {
+        auto const start = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::steady_clock::now() - start);
+    }
+
+    return std::chrono::duration<double, std::milli>{best}.count();
+}
+
+auto tune(TuneOptions const &options) -> Tuning {
+    auto const [width, height, num_frames, repeats, max_threads] = options;
+    auto const rect = Rect{0, 0, width, height};
+
+    // frames from all over the animation, not just its start
+    SyntheticSource source{width, height, 256, 1};
+    std::vector<Frame> frames;
+    for (usize i{}; i < num_frames; ++i) {
+        frames.push_back(*source.load(i * 256 / num_frames));
+    }
+
+    auto const out = frame_pool().acquire(width * height * 4);
+    auto const indices = frame_pool().acquire(width * height);
+
+    // the palettes of the frames, as the writer builds them for the first
+    // frame (the one with the most to map)
+    auto palettes = [&](bool dither, usize max_pixels) {
+        std::vector<Palette> palettes;
+        for (auto const &frame : frames) {
+            palettes.emplace_back(nullptr, frame.pixels.get(), width, rect, 8,
+                                  dither, max_pixels);
+        }
+        return palettes;
+    };
+    auto threshold_palettes = palettes(false, SIZE_MAX);
+    auto dither_palettes = palettes(true, SIZE_MAX);
+
+    auto map = [&](bool dither, std::vector<Palette> &palettes, Search search,
+                   usize threads, usize stripe_rows) {
+        return fastest(repeats, [&] {
+            for (usize i{}; i < frames.size(); ++i) {
+                auto const image = frames[i].pixels.get();
+                if (dither)
+                    dither_image(nullptr, image, out.get(), indices.get(),
+                                 width, rect, palettes[i], search);
+                else
+                    threshold_image(nullptr, image, out.get(), indices.get(),
+                                    width, rect, palettes[i], search, threads,
+                                    stripe_rows);
+            }
+        });
+    };
+
+    printf("Tuning on %zu synthetic %zux%zu frames, times are for all of "
+           "them\n",
+           frames.size(), width, height);
+
+    Tuning tuning;
+
+    // === search ===
+    // both ways give the same colors, the faster one wins
+    printf("\nPalette search:\n");
+    auto best_time = HUGE_VAL;
+    for (auto const &[search, name] : search_names) {
+        auto const threshold = map(false, threshold_palettes, search, 1, 64);
+        auto const dither = map(true, dither_palettes, search, 1, 64);
+        printf("  %-6s %8.1fms thresholding, %8.1fms dithering\n", name.data(),
+               threshold, dither);
+
+        if (threshold + dither < best_time) {
+            best_time = threshold + dither;
+            tuning.search = search;
+        }
+    }
+
+    // approx is never picked, as it changes the GIF. How much faster it is,
+    // and how much further its colors are from the pixels than the closest
+    // ones (over RGB)
+    auto const approx = map(false, threshold_palettes, Search::approx, 1, 64);
+    auto const closest = frame_pool().acquire(width * height);
+    usize extra_error{};
+    usize pixels{};
+    int max_extra_error{};
+    for (usize i{}; i < frames.size(); ++i) {
+        auto const image = frames[i].pixels.get();
+        auto &pal = threshold_palettes[i];
+        threshold_image(nullptr, image, out.get(), closest.get(), width, rect,
+                        pal, Search::tree);
+        threshold_image(nullptr, image, out.get(), indices.get(), width, rect,
+                        pal, Search::approx);
+
+        for (usize p{}; p < rect.area(); ++p) {
+            auto const error = [&](usize ind) {
+                return abs(image[p * 4] - pal.r[ind]) +
+                       abs(image[p * 4 + 1] - pal.g[ind]) +
+                       abs(image[p * 4 + 2] - pal.b[ind]);
+            };
+            auto const extra =
+                error(indices.get()[p]) - error(closest.get()[p]);
+            extra_error += static_cast<usize>(extra);
+            max_extra_error = max(max_extra_error, extra);
+        }
+        pixels += rect.area();
+    }
+    printf("  %-6s %8.1fms thresholding, %.2f further on average, %d at most "
+           "(never picked)\n",
+           "approx", approx,
+           static_cast<double>(extra_error) / static_cast<double>(pixels),
+           max_extra_error);
+
+    // === threads and stripes ===
+    // more threads have to be clearly faster to be worth taking cores from
+    // decoding
+    printf("\nThresholding threads:\n");
+    auto const most_threads =
+        max_threads != 0
+            ? max_threads
+            : max(static_cast<usize>(std::thread::hardware_concurrency()),
+                  usize{1});
+    std::vector<usize> thread_counts;
+    for (usize threads{1}; threads < most_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(most_threads);
+
+    best_time = HUGE_VAL;
+    for (auto const threads : thread_counts) {
+        for (auto const stripe_rows : {usize{16}, usize{64}, usize{256}}) {
+            // a single thread maps all stripes the same way
+            if (threads == 1 && stripe_rows != 64) continue;
+
+            auto const time = map(false, threshold_palettes, tuning.search,
+                                  threads, stripe_rows);
+            printf("  %2zu threads, %3zu row stripes %8.1fms\n", threads,
+                   stripe_rows, time);
+
+            if (time < best_time * 0.97) {
+                best_time = time;
+                tuning.threads = threads;
+                tuning.stripe_rows = stripe_rows;
+            }
+        }
+    }
+
+    // === palette samples ===
+    // fewer pixels build the palette faster but may miss colors. The smallest
+    // sample that looks about as good as the whole frame and saves some time
+    // is used, within a factor of 4 of the frame as the synthetic frames are
+    // easier on palettes than most
+    printf("\nPalette samples (with dithering):\n");
+    auto sample_run = [&](usize max_pixels) {
+        auto sampled = palettes(true, max_pixels);
+        auto const build =
+            fastest(repeats, [&] { palettes(true, max_pixels); });
+        auto const dither = map(true, sampled, tuning.search, 1, 64);
+
+        double mse{};
+        for (usize i{}; i < frames.size(); ++i) {
+            dither_image(nullptr, frames[i].pixels.get(), out.get(),
+                         indices.get(), width, rect, sampled[i],
+                         tuning.search);
+            mse += measure_quality(frames[i].pixels.get(), out.get(), width,
+                                   height)
+                       .mse;
+        }
+        mse /= static_cast<double>(frames.size());
+        auto const psnr = mse == 0 ? HUGE_VAL
+                                   : 10 * std::log10(255.0 * 255.0 / mse);
+
+        printf("  %8zu pixels %8.1fms building, %8.1fms total, %.2fdB\n",
+               min(max_pixels, rect.area()), build, build + dither, psnr);
+        return std::pair{build + dither, psnr};
+    };
+
+    auto const [full_time, full_psnr] = sample_run(SIZE_MAX);
+    auto const first_sample = std::bit_floor(rect.area() - 1);
+    for (auto pixels = first_sample; pixels >= Writer::min_palette_pixels &&
+                                     pixels >= first_sample / 2;
+         pixels /= 2) {
+        auto const [time, psnr] = sample_run(pixels);
+        if (psnr < full_psnr - 0.1) break;
+        if (time < full_time * 0.97) tuning.palette_pixels = pixels;
+    }
+
+    printf("\nBest: %zu threads, %zu row stripes, %s search, palettes from "
+           "%s pixels\n",
+           tuning.threads, tuning.stripe_rows,
+           search_name(tuning.search).data(),
+           tuning.palette_pixels == SIZE_MAX
+               ? "all"
+               : std::to_string(tuning.palette_pixels).c_str());
+
+    return tuning;
+}
+
+} // namespace uppr::gif
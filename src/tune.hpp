@@ -0,0 +1,58 @@
+#pragma once
+
+#include "gif.hpp"
+
+#include <optional>
+#include <string>
+
+namespace uppr::gif {
+
+/// The settings of the encoder that depend on the machine more than on the
+/// frames, as measured by `giffer tune`. They are used for the `WriterOptions`
+/// that are left on auto.
+struct Tuning {
+    /// Threads mapping pixels to the palette when thresholding.
+    usize threads = 1;
+    /// Rows each of those threads maps at a time.
+    usize stripe_rows = 64;
+    /// How the closest palette colors are found.
+    Search search = Search::tree;
+    /// Most pixels a palette is built from, frames with more are sampled.
+    usize palette_pixels = SIZE_MAX;
+};
+
+/// Where the tuning profile of this machine is kept:
+/// `$XDG_CONFIG_HOME/giffer/tune.conf`, or `~/.config/giffer/tune.conf`. Empty
+/// when there is no home directory to put it in.
+auto tuning_path() -> std::string;
+
+/// Reads a tuning profile. Settings missing from it keep their default, and
+/// settings it doesn't know about are ignored.
+///
+/// A missing file gives `nullopt` quietly, a broken one with an error.
+auto read_tuning(std::string const &path) -> std::optional<Tuning>;
+
+/// Writes a tuning profile to `path`, creating its directory if needed.
+auto write_tuning(std::string const &path, Tuning const &tuning) -> bool;
+
+/// The tuning profile of this machine, read from `tuning_path` the first time
+/// it is needed. The defaults when there is none.
+auto host_tuning() -> Tuning const &;
+
+/// What `tune` benchmarks with.
+struct TuneOptions {
+    /// Size of the synthetic frames.
+    usize width = 1280;
+    usize height = 720;
+    usize frames = 2;
+    /// Each measurement is the fastest of this many runs.
+    usize repeats = 2;
+    /// Most threads to try, 0 for one per core.
+    usize max_threads = 0;
+};
+
+/// Finds the best settings for this machine by timing the stages they affect on
+/// synthetic frames, printing the measurements as it goes.
+auto tune(TuneOptions const &options) -> Tuning;
+
+} // namespace uppr::gif
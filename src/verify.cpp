@@ -0,0 +1,237 @@
+#include "verify.hpp"
+#include "decode.hpp"
+#include "frame_source.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace uppr::gif {
+
+/// One way of spreading the work of an encode over threads. None of them
+/// should change the GIF.
+struct Schedule {
+    /// Threads and stripe size of the palette mapping.
+    usize threads;
+    usize stripe_rows;
+    Search search;
+    /// Threads decoding (here, drawing and blending) frames ahead, and how
+    /// many frames can wait.
+    usize decode_threads;
+    usize prefetch;
+};
+
+/// What is being encoded.
+struct Case {
+    SyntheticContent content;
+    std::string_view content_name;
+    bool dither;
+    /// Averages pairs of frames, like `--fps` with `--blend` does.
+    bool blend;
+    /// What sets the case apart from the plain ones, when something does.
+    std::string_view variant = "";
+    /// Every schedule searches with `Search::approx` instead of its own
+    /// search, as it picks other colors than they do.
+    bool approx = false;
+    /// Above 0, a hole with soft edges moves over the frames, so that pixels
+    /// go from painted to transparent and back.
+    u8 alpha_threshold = 0;
+    bool interlace = false;
+    Compression compression = COMPRESS_FAST;
+    int delta_palette_error = 0;
+};
+
+/// Cuts a round hole into the frames of another source, moving a little on
+/// each frame. Its edge fades over a few pixels, so that some of them are on
+/// either side of any alpha threshold.
+struct HoleSource : IndexedSource {
+    std::unique_ptr<IndexedSource> inner;
+
+    explicit HoleSource(std::unique_ptr<IndexedSource> inner)
+        : inner{std::move(inner)} {}
+
+    auto count() const -> usize override { return inner->count(); }
+    auto load(usize i) -> std::optional<Frame> override {
+        auto frame = inner->load(i);
+        if (!frame) return frame;
+
+        auto const width = frame->width;
+        auto const height = frame->height;
+        auto const radius = static_cast<int>(min(width, height) / 4);
+        auto const cx = static_cast<int>((width / 4 + i * 3) % width);
+        auto const cy = static_cast<int>(height / 2);
+        for (usize y{}; y < height; ++y) {
+            for (usize x{}; x < width; ++x) {
+                auto const dx = static_cast<int>(x) - cx;
+                auto const dy = static_cast<int>(y) - cy;
+                auto const distance = static_cast<int>(
+                    std::sqrt(static_cast<double>(dx * dx + dy * dy)));
+                auto const alpha = std::clamp(
+                    (distance - radius) * 32 + 128, 0, 255);
+                auto &a = frame->pixels.get()[(y * width + x) * 4 + 3];
+                a = min(a, static_cast<u8>(alpha));
+            }
+        }
+
+        return frame;
+    }
+};
+
+/// Encodes `test` with `schedule` to `path`, and gives what was written.
+auto encode(VerifyOptions const &options, Case const &test,
+            Schedule const &schedule, std::string const &path)
+    -> std::optional<Buffer> {
+    auto const [width, height, frames, max_threads] = options;
+    usize const delay = 2;
+
+    std::unique_ptr<IndexedSource> inputs = std::make_unique<SyntheticSource>(
+        width, height, test.blend ? frames * 2 : frames, delay, test.content);
+    if (test.alpha_threshold != 0)
+        inputs = std::make_unique<HoleSource>(std::move(inputs));
+    auto plan = plan_frames(inputs->count(), delay, FrameRange{},
+                            test.blend ? std::optional{25.0} : std::nullopt,
+                            DECIMATE_BLEND);
+    PrefetchSource source{
+        std::make_unique<PlannedSource>(std::move(inputs), std::move(plan)),
+        schedule.decode_threads, schedule.prefetch};
+
+    WriterOptions writer_options;
+    writer_options.threads = schedule.threads;
+    writer_options.stripe_rows = schedule.stripe_rows;
+    writer_options.search = test.approx ? Search::approx : schedule.search;
+    // the only setting of the tuning profile that changes the GIF
+    writer_options.palette_pixels = SIZE_MAX;
+    writer_options.alpha_threshold = test.alpha_threshold;
+    writer_options.interlace = test.interlace;
+    writer_options.compression = test.compression;
+    writer_options.delta_palette_error = test.delta_palette_error;
+
+    {
+        auto writer = Writer::open(path, width, height, delay, 8, test.dither,
+                                   writer_options);
+        if (!writer) {
+            fprintf(stderr, "Error writing %s\n", path.c_str());
+            return std::nullopt;
+        }
+
+        while (auto const frame = source.next()) {
+            writer->write_frame(frame->pixels.get(), width, height,
+                                frame->delay, 8, test.dither);
+        }
+        if (source.failed || !writer->close()) return std::nullopt;
+    }
+
+    auto data = frame_pool().acquire(0);
+    if (!read_file(path, data)) return std::nullopt;
+
+    return data;
+}
+
+auto verify_determinism(VerifyOptions const &options) -> bool {
+    auto const most_threads =
+        options.max_threads != 0
+            ? options.max_threads
+            : max(2 * static_cast<usize>(std::thread::hardware_concurrency()),
+                  usize{4});
+
+    // the first one does everything in order on one thread, the others split
+    // the work in uneven ways and with more threads than cores
+    Schedule const schedules[] = {
+        {1, 64, Search::tree, 1, 1},
+        {2, 1, Search::cache, 2, 2},
+        {3, 7, Search::tree, 3, 8},
+        {most_threads, 16, Search::cache, most_threads, 4},
+        {most_threads, 256, Search::tree, most_threads, most_threads * 2},
+    };
+
+    // every kind of frame thresholded, dithered and blended, and with each of
+    // the settings that change the GIF, as they take other paths through the
+    // encoder
+    std::vector<Case> cases;
+    for (auto const &[content, name] : synthetic_contents) {
+        cases.push_back({content, name, false, false});
+        cases.push_back({content, name, true, false});
+        cases.push_back({content, name, true, true, "blend"});
+        cases.push_back({content, name, true, false, "approx", true});
+        cases.push_back({content, name, false, false, "alpha", false, 128});
+        cases.push_back(
+            {content, name, true, false, "interlace", false, 0, true});
+        cases.push_back({content, name, false, false, "compress", false, 0,
+                         false, COMPRESS_MAX});
+        // loose enough that gradients get entries replaced
+        cases.push_back({content, name, false, false, "delta", false, 0,
+                         false, COMPRESS_FAST, 24});
+    }
+
+    auto const path =
+        (std::filesystem::temp_directory_path() /
+         ("giffer-verify-" + std::to_string(std::random_device{}()) + ".gif"))
+            .string();
+
+    printf("Encoding %zu synthetic %zux%zu frames of each kind in %zu ways, "
+           "with up to %zu threads\n\n",
+           options.frames, options.width, options.height,
+           std::size(schedules), most_threads);
+
+    usize failures{};
+    for (auto const &test : cases) {
+        printf("  %-10s %-9s %-9s", test.content_name.data(),
+               test.dither ? "dithered" : "threshold", test.variant.data());
+        fflush(stdout);
+
+        // every schedule is compared to the first one, which is also run
+        // again to compare to itself
+        auto const reference = encode(options, test, schedules[0], path);
+        std::string result = reference ? "same" : "failed to encode";
+        for (auto const &schedule : schedules) {
+            if (!reference) break;
+
+            auto const data = encode(options, test, schedule, path);
+            if (!data) {
+                result = "failed to encode";
+                break;
+            }
+
+            auto const size = min(data->size, reference->size);
+            auto const at = static_cast<usize>(
+                std::mismatch(data->get(), data->get() + size,
+                              reference->get())
+                    .first -
+                data->get());
+            if (at != size || data->size != reference->size) {
+                result = "DIFFERS with " + std::to_string(schedule.threads) +
+                         " threads, " + std::to_string(schedule.stripe_rows) +
+                         " row stripes, " +
+                         (test.approx                        ? "approx"
+                          : schedule.search == Search::cache ? "cache"
+                                                             : "tree") +
+                         " search, " +
+                         std::to_string(schedule.decode_threads) +
+                         " decode threads at byte " + std::to_string(at);
+                break;
+            }
+        }
+
+        if (result != "same") ++failures;
+        printf(" %8zu bytes  %s\n", reference ? reference->size : 0,
+               result.c_str());
+    }
+
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    if (failures != 0) {
+        printf("\n%zu of %zu GIFs depend on how the work was scheduled\n",
+               failures, cases.size());
+        return false;
+    }
+
+    printf("\nAll %zu GIFs are the same however the work is scheduled\n",
+           cases.size());
+    return true;
+}
+
+} // namespace uppr::gif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "gif.hpp"
+
+namespace uppr::gif {
+
+/// What `verify` encodes.
+struct VerifyOptions {
+    /// Size of the synthetic frames.
+    usize width = 256;
+    usize height = 192;
+    usize frames = 8;
+    /// Most threads to use, 0 for twice one per core (so that they have to
+    /// take turns).
+    usize max_threads = 0;
+};
+
+/// Encodes synthetic frames of every kind with different numbers of threads,
+/// stripe sizes, palette searches and decoding schedules, and checks that they
+/// all give the same GIF, byte for byte. Prints the results as it goes, and
+/// returns whether all of them matched.
+auto verify_determinism(VerifyOptions const &options) -> bool;
+
+} // namespace uppr::gif